@@ -0,0 +1,93 @@
+/*
+Mazedemo, by Max Eliaser
+
+Copyright (c) 2014 Intel Corp.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Counts heap allocations by interposing the allocator entry points. Any 
+// program linked with this file gets every malloc in the process counted, 
+// including the ones made inside OpenCV and libstdc++, which is what lets
+// the benchmark report allocations per frame. The real work is passed
+// through to glibc's internal entry points.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <errno.h>
+#include "mazedemo_common.h"
+
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t nmemb, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+extern void *__libc_memalign (size_t alignment, size_t size);
+
+static unsigned long num_allocs;
+
+static inline void count_alloc (void)
+{
+    __atomic_fetch_add (&num_allocs, 1, __ATOMIC_RELAXED);
+}
+
+unsigned long alloc_count (void)
+{
+    return __atomic_load_n (&num_allocs, __ATOMIC_RELAXED);
+}
+
+void *malloc (size_t size)
+{
+    count_alloc ();
+    return __libc_malloc (size);
+}
+
+void *calloc (size_t nmemb, size_t size)
+{
+    count_alloc ();
+    return __libc_calloc (nmemb, size);
+}
+
+void *realloc (void *ptr, size_t size)
+{
+    count_alloc ();
+    return __libc_realloc (ptr, size);
+}
+
+void *memalign (size_t alignment, size_t size)
+{
+    count_alloc ();
+    return __libc_memalign (alignment, size);
+}
+
+void *aligned_alloc (size_t alignment, size_t size)
+{
+    count_alloc ();
+    return __libc_memalign (alignment, size);
+}
+
+int posix_memalign (void **memptr, size_t alignment, size_t size)
+{
+    void *ret;
+    
+    count_alloc ();
+    ret = __libc_memalign (alignment, size);
+    if (!ret)
+        return ENOMEM;
+    *memptr = ret;
+    return 0;
+}
@@ -0,0 +1,204 @@
+/*
+Mazedemo, by Max Eliaser
+
+Copyright (c) 2014 Intel Corp.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Offline grading of scanned worksheets. Detection runs on a work-stealing
+// pool across all the cores. Each image's arrows are then traced through 
+// the one maze and written out as a JSON line, on the calling thread and in
+// input order, as soon as everything before it is done. So the output is 
+// the same however the work happened to get spread out.
+
+#include "opencv2/highgui/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <stdio.h>
+#include <math.h>
+#include <sys/stat.h>
+#include "mazedemo_common.h"
+#include "work_pool.h"
+#include "trace.h"
+
+using namespace cv;
+using namespace std;
+
+typedef struct
+{
+    bool done, readable;
+    arrowvec_t arrows;
+} batch_result_t;
+
+// The images to grade from one command line argument: all of a directory's
+// (sorted by name), a single image, or a text file listing them one per 
+// line
+static bool add_inputs (const string &arg, vector<string> &paths)
+{
+    struct stat st;
+    if (stat (arg.c_str (), &st) != 0)
+    {
+        cerr << "Can't find " << arg << endl;
+        return false;
+    }
+    if (S_ISDIR (st.st_mode))
+        return list_images (arg, paths);
+    if (has_image_extension (arg))
+    {
+        paths.push_back (arg);
+        return true;
+    }
+    
+    ifstream list (arg.c_str ());
+    string line;
+    while (getline (list, line))
+    {
+        if (!line.empty ())
+            paths.push_back (line);
+    }
+    return true;
+}
+
+// Scans come in at whatever resolution the scanner was set to, usually a 
+// few times the camera's, while detection's size limits are in pixels at 
+// the capture size. So each image is brought to the same number of pixels 
+// as a captured frame, keeping its shape, before it's looked at.
+static void fit_to_capture_size (const Mat &scan, Mat &gray)
+{
+    double factor = sqrt ((double)cfg_w * cfg_h / scan.total ());
+    if (fabs (factor - 1) < 0.01)
+    {
+        gray = scan;
+        return;
+    }
+    TRACE_SCOPE ("resize");
+    resize (scan, gray, Size (), factor, factor, factor < 1 ? INTER_AREA : INTER_LINEAR);
+}
+
+static void print_json_string (const string &s)
+{
+    putchar ('"');
+    for (size_t i = 0; i < s.size (); i++)
+    {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\')
+            printf ("\\%c", c);
+        else if (c < 0x20)
+            printf ("\\u%04x", c);
+        else
+            putchar (c);
+    }
+    putchar ('"');
+}
+
+int run_batch (const vector<string> &inputs, uint64_t seed, int side, int num_threads)
+{
+    vector<string> paths;
+    for (size_t i = 0; i < inputs.size (); i++)
+    {
+        if (!add_inputs (inputs[i], paths))
+            return 1;
+    }
+    if (paths.empty ())
+    {
+        cerr << "No images to grade" << endl;
+        return 1;
+    }
+    if (num_threads <= 0)
+        num_threads = max (1u, thread::hardware_concurrency ());
+    
+    // Every image is a sheet of its own, so there's nothing to carry over 
+    // from one to the next
+    detect_config.incremental = detect_config.track = false;
+    
+    mazepublic_t maze, trace;
+    cleanup_maze ();
+    generate_maze_seeded (side, side, seed, &maze);
+    
+    vector<batch_result_t> results (paths.size ());
+    for (size_t i = 0; i < results.size (); i++)
+        results[i].done = results[i].readable = false;
+    // One per worker, just for the buffers
+    vector<detect_state_t> states (num_threads);
+    mutex lock;
+    condition_variable ready;
+    
+    timestamp_t start = chrono::steady_clock::now ();
+    work_pool_t pool;
+    thread workers ([&] (void)
+    {
+        pool.run (paths.size (), num_threads, [&] (int i, int worker)
+        {
+            batch_result_t &result = results[i];
+            Mat scan, gray;
+            {
+                TRACE_SCOPE ("imread");
+                scan = imread (paths[i], CV_LOAD_IMAGE_GRAYSCALE);
+            }
+            if (!scan.empty ())
+            {
+                fit_to_capture_size (scan, gray);
+                do_process (gray, result.arrows, &states[worker]);
+            }
+            
+            lock_guard<mutex> guard (lock);
+            result.readable = !scan.empty ();
+            result.done = true;
+            ready.notify_one ();
+        });
+    });
+    
+    static const char dir_chars[] = {'U', 'D', 'R', 'L'}; // same order as arrowdir_t
+    int solved = 0;
+    maze_progress_t progress;
+    for (size_t i = 0; i < paths.size (); i++)
+    {
+        batch_result_t &result = results[i];
+        {
+            unique_lock<mutex> guard (lock);
+            ready.wait (guard, [&] (void) {return result.done;});
+        }
+        
+        printf ("{\"image\": ");
+        print_json_string (paths[i]);
+        if (!result.readable)
+        {
+            printf (", \"error\": \"unreadable\"}\n");
+            continue;
+        }
+        
+        bool won = maze_trace (result.arrows.size (), result.arrows.empty () ? NULL : &result.arrows[0], &trace, &progress);
+        solved += won;
+        string dirs;
+        for (auto a = result.arrows.begin (); a != result.arrows.end (); a++)
+            dirs += dir_chars[a->dir];
+        printf (", \"arrows\": \"%s\", \"solved\": %s, \"steps_left\": %d, \"first_wrong\": %d}\n",
+                dirs.c_str (), won ? "true" : "false", progress.dist, progress.first_wrong);
+        arrowvec_t ().swap (result.arrows);
+    }
+    workers.join ();
+    
+    double secs = chrono::duration<double> (chrono::steady_clock::now () - start).count ();
+    fprintf (stderr, "%d images in %.3f s (%.1f per second) on %d threads, %d solved\n",
+             (int)paths.size (), secs, secs > 0 ? paths.size () / secs : 0.0, num_threads, solved);
+    return 0;
+}
@@ -0,0 +1,119 @@
+/*
+Mazedemo, by Max Eliaser
+
+Copyright (c) 2014 Intel Corp.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Fixed-capacity blocking queue for handing work between pipeline stages.
+// Unlike mailbox_t, every item that goes in comes out (or is handed back to 
+// the producer when it gets dropped), so it's suitable for passing around 
+// pooled objects that have to be recycled.
+
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+// What push () does when the queue is full
+typedef enum 
+{
+    queue_block,        // wait for the consumer to make room (backpressure)
+    queue_drop_oldest   // evict the oldest item and hand it back to the caller
+} queue_policy_t;
+
+template <typename T>
+class bounded_queue_t
+{
+    std::mutex lock;
+    std::condition_variable not_empty, not_full;
+    std::vector<T> ring;
+    size_t head, count;
+    queue_policy_t policy;
+    bool closed;
+    
+public:
+    bounded_queue_t (void) : head (0), count (0), policy (queue_block), closed (false) {}
+    
+    void init (size_t capacity, queue_policy_t _policy)
+    {
+        ring.resize (capacity);
+        head = count = 0;
+        policy = _policy;
+        closed = false;
+    }
+    
+    // Returns false if the queue was closed, in which case item wasn't 
+    // queued. If the oldest item had to be evicted to make room, it's stored
+    // in *dropped so the caller can recycle it; otherwise *dropped is T ().
+    bool push (const T &item, T *dropped = NULL)
+    {
+        std::unique_lock<std::mutex> guard (lock);
+        if (dropped)
+            *dropped = T ();
+        if (policy == queue_block)
+        {
+            while (count == ring.size () && !closed)
+                not_full.wait (guard);
+        }
+        if (closed)
+            return false;
+        if (count == ring.size ())
+        {
+            if (dropped)
+                *dropped = ring[head];
+            head = (head + 1) % ring.size ();
+            count--;
+        }
+        ring[(head + count) % ring.size ()] = item;
+        count++;
+        not_empty.notify_one ();
+        return true;
+    }
+    
+    // Blocks until there's an item. Returns false once the queue has been
+    // closed and drained.
+    bool pop (T &item)
+    {
+        std::unique_lock<std::mutex> guard (lock);
+        while (count == 0 && !closed)
+            not_empty.wait (guard);
+        if (count == 0)
+            return false;
+        item = ring[head];
+        head = (head + 1) % ring.size ();
+        count--;
+        not_full.notify_one ();
+        return true;
+    }
+    
+    // Wakes up everybody waiting on the queue and makes further pushes fail
+    void close (void)
+    {
+        std::lock_guard<std::mutex> guard (lock);
+        closed = true;
+        not_empty.notify_all ();
+        not_full.notify_all ();
+    }
+};
+
+#endif
@@ -0,0 +1,286 @@
+/*
+Mazedemo, by Max Eliaser
+
+Copyright (c) 2014 Intel Corp.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Incremental re-detection. Most of the time the worksheet just sits there
+// and the only thing changing is a hand adding one arrow, so there's no
+// point in running Canny and findContours over the whole frame again. The
+// frame is divided into tiles and compared against the last processed 
+// frame; only the tiles that changed (plus a halo big enough to hold any 
+// arrow touching them) are re-detected, and the contours from everywhere 
+// else are carried over from last time.
+//
+// A contour belongs to the changed part of the frame if its bounding box
+// touches a changed tile. Cached contours that do are thrown away, newly 
+// found contours that don't are ignored (the cache already has them), so 
+// every arrow comes from exactly one of the two.
+
+#include "opencv2/imgproc/imgproc.hpp"
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include "mazedemo_common.h"
+#include "trace.h"
+
+using namespace cv;
+using namespace std;
+
+const int tile_size = 64;
+
+// A pixel has changed if it's this much brighter or darker than before, and
+// a tile has changed if more than this many of its pixels have. Camera 
+// noise stays well under both.
+const int pixel_threshold = 24;
+const int tile_threshold = 16;
+
+// Largest extent of an arrow we'd accept (times scale_len), so the halo can
+// contain any arrow that touches a changed tile
+const double max_arrow_len = 160;
+
+// Every so often re-detect the whole frame anyway, in case something slipped
+// under the thresholds
+const int full_refresh_interval = 30;
+
+// Past this fraction of the frame, one big pass is cheaper than many small
+// ones
+const double max_partial_fraction = 0.6;
+
+static bool touches_any (const Rect &r, const vector<Rect> &rects)
+{
+    for (auto i = rects.begin (); i != rects.end (); i++)
+    {
+        if ((r & *i).area () > 0)
+            return true;
+    }
+    return false;
+}
+
+static void find_changes (const Mat &gray, detect_state_t &state, frame_changes_t &changes)
+{
+    TRACE_SCOPE ("find_changes");
+    
+    changes.changed.clear ();
+    changes.regions.clear ();
+    changes.full = state.reference.size () != gray.size () || 
+                   ++state.frames_since_full >= full_refresh_interval;
+    
+    if (!changes.full)
+    {
+        absdiff (gray, state.reference, state.diff);
+        threshold (state.diff, state.diff, pixel_threshold, 255, THRESH_BINARY);
+        
+        int tiles_x = (gray.cols + tile_size - 1) / tile_size;
+        int tiles_y = (gray.rows + tile_size - 1) / tile_size;
+        int halo = (int)ceil (max_arrow_len*scale_len / tile_size);
+        Rect frame_rect (0, 0, gray.cols, gray.rows);
+        
+        // Find the changed tiles, recording them as horizontal runs, and 
+        // mark each one's halo as needing re-detection
+        vector<bool> &dirty = state.dirty_tiles;
+        dirty.assign (tiles_x * tiles_y, false);
+        for (int ty = 0; ty < tiles_y; ty++)
+        {
+            int run_start = -1;
+            for (int tx = 0; tx <= tiles_x; tx++)
+            {
+                bool changed = false;
+                if (tx < tiles_x)
+                {
+                    Rect tile = Rect (tx * tile_size, ty * tile_size, tile_size, tile_size) & frame_rect;
+                    changed = countNonZero (state.diff (tile)) > tile_threshold;
+                }
+                
+                if (changed)
+                {
+                    if (run_start < 0)
+                        run_start = tx;
+                    for (int y = max (0, ty - halo); y <= min (tiles_y - 1, ty + halo); y++)
+                    {
+                        for (int x = max (0, tx - halo); x <= min (tiles_x - 1, tx + halo); x++)
+                            dirty[y * tiles_x + x] = true;
+                    }
+                }
+                else if (run_start >= 0)
+                {
+                    changes.changed.push_back (Rect (run_start * tile_size, ty * tile_size, 
+                                                     (tx - run_start) * tile_size, tile_size) & frame_rect);
+                    run_start = -1;
+                }
+            }
+        }
+        
+        // Each connected group of tiles to re-detect becomes one region
+        vector<int> &stack = state.tile_stack;
+        stack.clear ();
+        int dirty_area = 0;
+        for (int start = 0; start < tiles_x * tiles_y; start++)
+        {
+            if (!dirty[start])
+                continue;
+            int x0 = tiles_x, y0 = tiles_y, x1 = -1, y1 = -1;
+            dirty[start] = false;
+            stack.push_back (start);
+            while (!stack.empty ())
+            {
+                int t = stack.back (), tx = t % tiles_x, ty = t / tiles_x;
+                stack.pop_back ();
+                x0 = min (x0, tx);
+                y0 = min (y0, ty);
+                x1 = max (x1, tx);
+                y1 = max (y1, ty);
+                if (tx > 0 && dirty[t - 1])
+                    dirty[t - 1] = false, stack.push_back (t - 1);
+                if (tx < tiles_x - 1 && dirty[t + 1])
+                    dirty[t + 1] = false, stack.push_back (t + 1);
+                if (ty > 0 && dirty[t - tiles_x])
+                    dirty[t - tiles_x] = false, stack.push_back (t - tiles_x);
+                if (ty < tiles_y - 1 && dirty[t + tiles_x])
+                    dirty[t + tiles_x] = false, stack.push_back (t + tiles_x);
+            }
+            changes.regions.push_back (Rect (x0 * tile_size, y0 * tile_size,
+                                             (x1 - x0 + 1) * tile_size, (y1 - y0 + 1) * tile_size) & frame_rect);
+        }
+        
+        // Bounding boxes of separate groups can still overlap, and 
+        // overlapping regions would find the same contour twice
+        for (bool merged = true; merged; )
+        {
+            merged = false;
+            for (size_t i = 0; i < changes.regions.size () && !merged; i++)
+            {
+                for (size_t j = i + 1; j < changes.regions.size () && !merged; j++)
+                {
+                    if ((changes.regions[i] & changes.regions[j]).area () > 0)
+                    {
+                        changes.regions[i] |= changes.regions[j];
+                        changes.regions.erase (changes.regions.begin () + j);
+                        merged = true;
+                    }
+                }
+            }
+        }
+        
+        for (auto i = changes.regions.begin (); i != changes.regions.end (); i++)
+            dirty_area += i->area ();
+        if (dirty_area > max_partial_fraction * frame_rect.area ())
+            changes.full = true;
+    }
+    
+    if (changes.full)
+    {
+        changes.changed.clear ();
+        changes.regions.clear ();
+        state.frames_since_full = 0;
+    }
+    
+    gray.copyTo (state.reference);
+}
+
+void detect_changed_edges (const Mat &gray, detect_state_t &state, frame_changes_t &changes, Mat &edges)
+{
+    find_changes (gray, state, changes);
+    if (changes.full)
+    {
+        detect_edges (gray, edges);
+        return;
+    }
+    
+    // Each region is edge-detected into scratch rather than straight into 
+    // edges, because dilate would otherwise read stale pixels from outside 
+    // the region.
+    edges.create (gray.size (), CV_8UC1);
+    for (auto i = changes.regions.begin (); i != changes.regions.end (); i++)
+    {
+        Mat region_edges = reuse_buffer (state.scratch, i->size (), CV_8UC1);
+        detect_edges (gray (*i), region_edges);
+        region_edges.copyTo (edges (*i));
+    }
+}
+
+void detect_changed_contours (Mat &edges, const Mat &gray, const frame_changes_t &changes, detect_state_t &state, candidate_table_t &candidates)
+{
+    if (changes.full)
+    {
+        detect_contours (edges, gray, candidates);
+        state.cached = candidates;
+        return;
+    }
+    
+    TRACE_SCOPE ("merge_contours");
+    candidates.clear ();
+    candidate_table_t &found = state.found;
+    bool truncated = false;
+    for (auto r = changes.regions.begin (); r != changes.regions.end () && !truncated; r++)
+    {
+        Mat region_edges = edges (*r);
+        found.clear ();
+        find_candidates (region_edges, r->tl (), gray, found);
+        for (int i = 0; i < found.size (); i++)
+        {
+            Rect bbox = found.bbox (i);
+            if (!touches_any (bbox, changes.changed))
+                continue;
+            
+            // findContours can't see past the edge of the region, so a
+            // contour running into it has been cut off. The halo makes this
+            // rare, but if it does happen just do the whole frame.
+            if ((bbox.x <= r->x + 1 && r->x > 0) ||
+                (bbox.y <= r->y + 1 && r->y > 0) ||
+                (bbox.br ().x >= r->br ().x - 1 && r->br ().x < gray.cols) ||
+                (bbox.br ().y >= r->br ().y - 1 && r->br ().y < gray.rows))
+            {
+                truncated = true;
+                break;
+            }
+            candidates.copy_row (found, i);
+        }
+    }
+    
+    if (truncated)
+    {
+        detect_edges (gray, edges);
+        detect_contours (edges, gray, candidates);
+        state.cached = candidates;
+        return;
+    }
+    
+    // Cached candidates away from the changes are still good, except where
+    // a new one overlaps them: a new mark drawn next to an old arrow can be
+    // dilated into the same blob, or drawn around it, and then the old 
+    // arrow is already part of the new outline (and findContours would 
+    // never have given it separately.)
+    int num_new = candidates.size ();
+    for (int i = 0; i < state.cached.size (); i++)
+    {
+        Rect bbox = state.cached.bbox (i);
+        if (touches_any (bbox, changes.changed))
+            continue;
+        bool overlapped = false;
+        for (int j = 0; j < num_new && !overlapped; j++)
+            overlapped = (bbox & candidates.bbox (j)).area () > 0;
+        if (!overlapped)
+            candidates.copy_row (state.cached, i);
+    }
+    
+    state.cached = candidates;
+}
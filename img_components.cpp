@@ -0,0 +1,256 @@
+/*
+Mazedemo, by Max Eliaser
+
+Copyright (c) 2014 Intel Corp.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Arrow candidates from connected-component labelling, as an alternative to
+// tracing contours (detect_config.components.) The dilated edge image is 
+// labelled in one pass down the rows, a run at a time, with each label 
+// adding up its pixel count, bounding box and moments as it goes and 
+// union-find joining runs that touch. The background is labelled too, so 
+// holes can be filled in: that way the area is what's inside the outline 
+// and blobs inside other blobs don't count, as with findContours.
+//
+// The axis weights are the spread of the pixels instead of the outline 
+// length along each axis (the classifier only compares the two), and the
+// outline is just the bounding box.
+
+#include "opencv2/imgproc/imgproc.hpp"
+#include <math.h>
+#include "mazedemo_common.h"
+#include "trace.h"
+
+using namespace cv;
+using namespace std;
+
+typedef struct
+{
+    int64 n, sx, sy, sxx, syy;
+    int x0, y0, x1, y1; // x1 and y1 inclusive
+} blob_stats_t;
+
+typedef struct
+{
+    int start, end; // end exclusive
+    int label;
+    bool foreground;
+} run_t;
+
+// Working space, kept from call to call (one set per thread)
+static thread_local struct
+{
+    vector<int> parent;
+    vector<blob_stats_t> stats;
+    vector<int> above; // label of the pixel above each label's first one, or -1
+    vector<char> background, border; // border: background that reaches the edge
+    vector<char> enclosed;
+    vector<run_t> prev, cur;
+    Mat sum_buffer;
+} scratch;
+
+static int find_root (vector<int> &parent, int label)
+{
+    while (parent[label] != label)
+    {
+        parent[label] = parent[parent[label]];
+        label = parent[label];
+    }
+    return label;
+}
+
+// The older label always ends up as the root
+static int join (vector<int> &parent, int a, int b)
+{
+    a = find_root (parent, a);
+    b = find_root (parent, b);
+    if (a > b)
+        swap (a, b);
+    parent[b] = a;
+    return a;
+}
+
+static void merge_stats (blob_stats_t &into, const blob_stats_t &from)
+{
+    into.n += from.n;
+    into.sx += from.sx;
+    into.sy += from.sy;
+    into.sxx += from.sxx;
+    into.syy += from.syy;
+    into.x0 = min (into.x0, from.x0);
+    into.y0 = min (into.y0, from.y0);
+    into.x1 = max (into.x1, from.x1);
+    into.y1 = max (into.y1, from.y1);
+}
+
+// Sum of the squares 0..k
+static inline int64 sum_squares (int64 k)
+{
+    return k * (k + 1) * (2 * k + 1) / 6;
+}
+
+void find_components (const Mat &edges, Point offset, const Mat &gray, candidate_table_t &candidates, double scale)
+{
+    TRACE_SCOPE ("components");
+    vector<int> &parent = scratch.parent, &above = scratch.above;
+    vector<blob_stats_t> &stats = scratch.stats;
+    vector<char> &background = scratch.background, &border = scratch.border, &enclosed = scratch.enclosed;
+    vector<run_t> &prev = scratch.prev, &cur = scratch.cur;
+    parent.clear ();
+    stats.clear ();
+    above.clear ();
+    background.clear ();
+    border.clear ();
+    prev.clear ();
+    
+    for (int y = 0; y < edges.rows; y++)
+    {
+        const uchar *e = edges.ptr<uchar> (y);
+        bool edge_row = y == 0 || y == edges.rows - 1;
+        cur.clear ();
+        size_t p = 0;
+        for (int x = 0; x < edges.cols; )
+        {
+            bool foreground = e[x] != 0;
+            int start = x;
+            while (x < edges.cols && (e[x] != 0) == foreground)
+                x++;
+            int end = x;
+            
+            // A blob joins every blob run in the row above that touches 
+            // it, diagonally included; background only joins background 
+            // directly above
+            while (p < prev.size () && prev[p].end < start)
+                p++;
+            int label = -1, label_above = -1;
+            for (size_t q = p; q < prev.size () && prev[q].start <= end; q++)
+            {
+                const run_t &r = prev[q];
+                if (r.start <= start && start < r.end)
+                    label_above = r.label;
+                if (r.foreground != foreground || (!foreground && (r.end <= start || r.start >= end)))
+                    continue;
+                label = label < 0 ? find_root (parent, r.label) : join (parent, label, r.label);
+            }
+            if (label < 0)
+            {
+                label = parent.size ();
+                parent.push_back (label);
+                above.push_back (label_above);
+                background.push_back (!foreground);
+                border.push_back (false);
+                blob_stats_t blank = {0, 0, 0, 0, 0, start, y, end - 1, y};
+                stats.push_back (blank);
+            }
+            if (!foreground && (edge_row || start == 0 || end == edges.cols))
+                border[label] = true;
+            
+            blob_stats_t &s = stats[label];
+            int64 len = end - start;
+            s.n += len;
+            s.sx += (int64)(start + end - 1) * len / 2;
+            s.sxx += sum_squares (end - 1) - sum_squares (start - 1);
+            s.sy += (int64)y * len;
+            s.syy += (int64)y * y * len;
+            s.x0 = min (s.x0, start);
+            s.x1 = max (s.x1, end - 1);
+            s.y1 = y;
+            
+            run_t run = {start, end, label, foreground};
+            cur.push_back (run);
+        }
+        prev.swap (cur);
+    }
+    
+    // Fold every label into its root. Roots come before anything joined to
+    // them, so one pass in order does it.
+    for (size_t l = 0; l < parent.size (); l++)
+    {
+        int root = find_root (parent, l);
+        if (root != (int)l)
+        {
+            merge_stats (stats[root], stats[l]);
+            border[root] |= border[l];
+        }
+    }
+    
+    // Fill in the holes. Whatever's around a hole or a blob started 
+    // further up the image, so it has an older label, and going from the 
+    // newest back every one is complete before it's added to its 
+    // surroundings.
+    enclosed.assign (parent.size (), false);
+    for (int l = parent.size () - 1; l >= 0; l--)
+    {
+        if (parent[l] != l || border[l] || above[l] < 0)
+            continue;
+        int around = find_root (parent, above[l]);
+        if (border[around])
+            continue; // a blob out in the open
+        merge_stats (stats[around], stats[l]);
+        enclosed[l] = true;
+    }
+    
+    TRACE_SCOPE ("filter_components");
+    Mat sum = reuse_buffer (scratch.sum_buffer, edges.size () + Size (1, 1), CV_32S);
+    bool summed = false;
+    double min_area = min_candidate_area*scale_area*scale*scale, max_area = max_candidate_area*scale_area*scale*scale;
+    for (size_t l = 0; l < parent.size (); l++)
+    {
+        const blob_stats_t &s = stats[l];
+        if (parent[l] != (int)l || background[l] || enclosed[l] || s.n < min_area || s.n > max_area)
+            continue;
+        
+        // Light blobs (glare) are no good, same as with contours, and the 
+        // same integral image makes it four lookups. It's only worked out
+        // once some blob gets this far.
+        if (!summed)
+        {
+            TRACE_SCOPE ("integral");
+            integral (gray (Rect (offset, edges.size ())), sum, CV_32S);
+            summed = true;
+        }
+        int sx0 = s.x0, sy0 = s.y0, sx1 = s.x1 + 1, sy1 = s.y1 + 1;
+        double box_sum = (double)sum.at<int> (sy1, sx1) - sum.at<int> (sy0, sx1) 
+                       - sum.at<int> (sy1, sx0) + sum.at<int> (sy0, sx0);
+        float darkness = box_sum / ((sx1 - sx0) * (sy1 - sy0));
+        if (darkness > max_candidate_darkness)
+            continue;
+        
+        double cx = (double)s.sx / s.n, cy = (double)s.sy / s.n;
+        int x0 = s.x0 + offset.x, y0 = s.y0 + offset.y, x1 = s.x1 + offset.x, y1 = s.y1 + offset.y;
+        candidates.start.push_back (candidates.points.size ());
+        candidates.count.push_back (4);
+        candidates.points.push_back (Point (x0, y0));
+        candidates.points.push_back (Point (x1, y0));
+        candidates.points.push_back (Point (x1, y1));
+        candidates.points.push_back (Point (x0, y1));
+        candidates.area.push_back (s.n);
+        candidates.cx.push_back (cx + offset.x);
+        candidates.cy.push_back (cy + offset.y);
+        candidates.vweight.push_back (sqrt (max (0.0, (double)s.syy / s.n - cy * cy)));
+        candidates.hweight.push_back (sqrt (max (0.0, (double)s.sxx / s.n - cx * cx)));
+        candidates.x0.push_back (x0);
+        candidates.y0.push_back (y0);
+        candidates.x1.push_back (x1 + 1);
+        candidates.y1.push_back (y1 + 1);
+        candidates.darkness.push_back (darkness);
+    }
+}
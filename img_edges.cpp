@@ -0,0 +1,290 @@
+/*
+Mazedemo, by Max Eliaser
+
+Copyright (c) 2014 Intel Corp.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Canny and dilate by hand, giving exactly what OpenCV's Canny (aperture 3,
+// L1 gradient) and dilate give, but working out of buffers kept from call 
+// to call so that once warmed up they never allocate. OpenCV's make a new 
+// filter engine and new gradient images every time. Having the pieces 
+// separate also lets the stripes (img_stripes.cpp) work out the gradient 
+// once and get both the candidates and the strong edges from it.
+//
+// The edge map goes through three values: canny_classify marks candidates
+// (a local maximum of the gradient over the low threshold) 1 and strong 
+// ones (over the high one as well) 2, and canny_follow turns everything it
+// reaches from a strong one 255. dilate_edges only looks for 255.
+
+#include "opencv2/imgproc/imgproc.hpp"
+#include <string.h>
+#include "mazedemo_common.h"
+#include "trace.h"
+
+using namespace cv;
+using namespace std;
+
+// tan 22.5 degrees in the same fixed point as Canny's, which its direction
+// test has to match bit for bit
+const int canny_shift = 15;
+const int tg22 = (int)(0.4142135623730950488016887242097 * (1 << canny_shift) + 0.5);
+
+static thread_local struct
+{
+    vector<int> mag; // three rows, with a zero either end
+    vector<short> dx, dy; // the same three rows
+    vector<int> half_widths;
+    vector<uchar> padded;
+    Mat near_buffer;
+} scratch;
+
+static inline int row_slot (int y)
+{
+    return (y % 3 + 3) % 3;
+}
+
+static inline void sobel_at (const uchar *a, const uchar *b, const uchar *c, int xm, int x, int xp, short &gx, short &gy)
+{
+    gx = (a[xp] - a[xm]) + 2 * (b[xp] - b[xm]) + (c[xp] - c[xm]);
+    gy = (c[xm] + 2 * c[x] + c[xp]) - (a[xm] + 2 * a[x] + a[xp]);
+}
+
+void canny_classify (const Mat &gray, int y0, int y1, Mat &map)
+{
+    TRACE_SCOPE ("canny_classify");
+    int rows = gray.rows, cols = gray.cols;
+    int low = cvFloor (canny_low), high = cvFloor (canny_high);
+    
+    // Like Canny's Sobel, read past gray's edges into its parent when it's
+    // a ROI, and repeat the outermost pixels past the parent's
+    Size whole;
+    Point ofs;
+    gray.locateROI (whole, ofs);
+    int top = -ofs.y, bottom = whole.height - ofs.y - 1;
+    int left = ofs.x > 0 ? -1 : 0, right = ofs.x + cols < whole.width ? cols : cols - 1;
+    
+    vector<int> &mag = scratch.mag;
+    vector<short> &dx = scratch.dx, &dy = scratch.dy;
+    mag.assign (3 * (cols + 2), 0);
+    dx.resize (3 * cols);
+    dy.resize (3 * cols);
+    
+    // Rows outside gray have no gradient
+    auto gradient_row = [&] (int y)
+    {
+        int slot = row_slot (y);
+        int *m = &mag[slot * (cols + 2) + 1];
+        short *gx = &dx[slot * cols], *gy = &dy[slot * cols];
+        if (y < 0 || y >= rows)
+        {
+            memset (m, 0, sizeof(*m) * cols);
+            return;
+        }
+        const uchar *a = gray.data + (ptrdiff_t)max (y - 1, top) * (ptrdiff_t)gray.step;
+        const uchar *b = gray.data + (ptrdiff_t)y * (ptrdiff_t)gray.step;
+        const uchar *c = gray.data + (ptrdiff_t)min (y + 1, bottom) * (ptrdiff_t)gray.step;
+        sobel_at (a, b, c, left, 0, cols > 1 ? 1 : right, gx[0], gy[0]);
+        for (int x = 1; x < cols - 1; x++)
+            sobel_at (a, b, c, x - 1, x, x + 1, gx[x], gy[x]);
+        if (cols > 1)
+            sobel_at (a, b, c, cols - 2, cols - 1, right, gx[cols - 1], gy[cols - 1]);
+        for (int x = 0; x < cols; x++)
+            m[x] = abs (gx[x]) + abs (gy[x]);
+    };
+    
+    gradient_row (y0 - 1);
+    gradient_row (y0);
+    for (int y = y0; y < y1; y++)
+    {
+        gradient_row (y + 1);
+        const int *mp = &mag[row_slot (y - 1) * (cols + 2) + 1];
+        const int *mc = &mag[row_slot (y) * (cols + 2) + 1];
+        const int *mn = &mag[row_slot (y + 1) * (cols + 2) + 1];
+        const short *gx = &dx[row_slot (y) * cols], *gy = &dy[row_slot (y) * cols];
+        uchar *out = map.ptr<uchar> (y);
+        for (int x = 0; x < cols; x++)
+        {
+            int m = mc[x];
+            uchar v = 0;
+            if (m > low)
+            {
+                // Which way the gradient points, to the nearest 45 degrees,
+                // and whether this is the biggest across it
+                int xs = gx[x], ys = gy[x];
+                int ax = abs (xs), ay = abs (ys) << canny_shift;
+                int tg22x = ax * tg22;
+                bool peak;
+                if (ay < tg22x)
+                    peak = m > mc[x - 1] && m >= mc[x + 1];
+                else
+                {
+                    int tg67x = tg22x + (ax << (canny_shift + 1));
+                    if (ay > tg67x)
+                        peak = m > mp[x] && m >= mn[x];
+                    else
+                    {
+                        int s = (xs ^ ys) < 0 ? -1 : 1;
+                        peak = m > mp[x - s] && m > mn[x + s];
+                    }
+                }
+                if (peak)
+                    v = m > high ? 2 : 1;
+            }
+            out[x] = v;
+        }
+    }
+}
+
+void canny_seed (Mat &map, int y0, int y1, vector<int> &stack)
+{
+    for (int y = y0; y < y1; y++)
+    {
+        uchar *p = map.ptr<uchar> (y);
+        for (int x = 0; x < map.cols; x++)
+        {
+            if (p[x] == 2)
+            {
+                p[x] = 255;
+                stack.push_back (y * map.cols + x);
+            }
+        }
+    }
+}
+
+void canny_follow (Mat &map, vector<int> &stack, int y0, int y1, vector<int> *found)
+{
+    int cols = map.cols;
+    while (!stack.empty ())
+    {
+        int p = stack.back ();
+        stack.pop_back ();
+        int x = p % cols, y = p / cols;
+        for (int ny = max (y0, y - 1); ny <= min (y1 - 1, y + 1); ny++)
+        {
+            uchar *row = map.ptr<uchar> (ny);
+            for (int nx = max (0, x - 1); nx <= min (cols - 1, x + 1); nx++)
+            {
+                if (row[nx] == 1)
+                {
+                    row[nx] = 255;
+                    stack.push_back (ny * cols + nx);
+                    if (found)
+                        found->push_back (ny * cols + nx);
+                }
+            }
+        }
+    }
+}
+
+void canny_edges (const Mat &gray, Mat &map, vector<int> &stack)
+{
+    map.create (gray.size (), CV_8UC1);
+    canny_classify (gray, 0, gray.rows, map);
+    TRACE_SCOPE ("canny_follow");
+    canny_seed (map, 0, gray.rows, stack);
+    canny_follow (map, stack, 0, gray.rows);
+}
+
+// Every row of the element has to be a run centred on the anchor's column
+// (as the ellipses are), and gets its half width, or -1 if it's empty
+static bool element_runs (const Mat &element, vector<int> &half_widths)
+{
+    int anchor = element.cols / 2;
+    half_widths.assign (element.rows, -1);
+    for (int r = 0; r < element.rows; r++)
+    {
+        const uchar *e = element.ptr<uchar> (r);
+        int first = -1, last = -1;
+        for (int c = 0; c < element.cols; c++)
+        {
+            if (!e[c])
+                continue;
+            if (first < 0)
+                first = c;
+            else if (c != last + 1)
+                return false;
+            last = c;
+        }
+        if (first < 0)
+            continue;
+        if (anchor - first != last - anchor)
+            return false;
+        half_widths[r] = last - anchor;
+    }
+    return true;
+}
+
+bool dilate_edges (const Mat &map, Mat &out, const Mat &element, int y0, int y1, int src_y0, int src_y1)
+{
+    vector<int> &half_widths = scratch.half_widths;
+    if (element.type () != CV_8UC1 || !element_runs (element, half_widths))
+        return false;
+    TRACE_SCOPE ("dilate_edges");
+    int cols = map.cols, anchor = element.rows / 2;
+    
+    // For each row of map that's needed, how far along the row the nearest
+    // edge is, if it's within reach (the widest half width). An output 
+    // pixel is then an edge if for some row of the element, the map row it 
+    // lands on has an edge no further away than that row's half width. All
+    // of it is worked out before anything is written, so out can be map.
+    int reach = *max_element (half_widths.begin (), half_widths.end ());
+    int n0 = max (max (0, src_y0), y0 - anchor);
+    int n1 = min (min (map.rows, src_y1), y1 + element.rows - 1 - anchor);
+    if (n1 <= n0 || reach < 0)
+    {
+        for (int y = y0; y < y1; y++)
+            memset (out.ptr<uchar> (y), 0, cols);
+        return true;
+    }
+    // Each row goes through a copy with reach pixels of nothing either side,
+    // so the search needs no bounds checks
+    vector<uchar> &padded = scratch.padded;
+    padded.assign (cols + 2 * reach, 0);
+    const uchar *p = &padded[reach];
+    Mat near = reuse_buffer (scratch.near_buffer, Size (cols, n1 - n0), CV_8UC1);
+    for (int y = n0; y < n1; y++)
+    {
+        memcpy (&padded[reach], map.ptr<uchar> (y), cols);
+        uchar *d = near.ptr<uchar> (y - n0);
+        memset (d, 255, cols);
+        for (int k = reach; k >= 0; k--)
+        {
+            for (int x = 0; x < cols; x++)
+                d[x] = (p[x - k] == 255) | (p[x + k] == 255) ? k : d[x];
+        }
+    }
+    
+    for (int y = y0; y < y1; y++)
+    {
+        uchar *o = out.ptr<uchar> (y);
+        memset (o, 0, cols);
+        for (int r = 0; r < element.rows; r++)
+        {
+            int sy = y + r - anchor, k = half_widths[r];
+            if (k < 0 || sy < n0 || sy >= n1)
+                continue;
+            const uchar *d = near.ptr<uchar> (sy - n0);
+            for (int x = 0; x < cols; x++)
+                o[x] |= d[x] <= k ? 255 : 0;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,129 @@
+/*
+Mazedemo, by Max Eliaser
+
+Copyright (c) 2014 Intel Corp.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Detection at reduced resolution, and the governor that decides when to 
+// use it. Everything in detection that depends on the size of the frame 
+// (the dilation, the contour simplification, the area limits) already 
+// follows the scale it's given, so a shrunk frame finds the same arrows,
+// just with coarser outlines. The Canny thresholds stay put: they're 
+// gradients per pixel, and shrinking with INTER_AREA keeps the contrast 
+// across a marker stroke about the same.
+
+#include "opencv2/imgproc/imgproc.hpp"
+#include <math.h>
+#include "mazedemo_common.h"
+#include "trace.h"
+
+using namespace cv;
+using namespace std;
+
+// Sizes to detect at, biggest first. Below a quarter the arrows are only a
+// few pixels wide, and more time goes on capture than on detection anyway.
+static const double level_scales[] = {1, 0.75, 0.5, 0.375, 0.25};
+static const int num_levels = sizeof(level_scales)/sizeof(*level_scales);
+
+// Frames to ignore after a change (they may have been on their way through
+// the pipeline at the old size), then frames to average over before 
+// judging the new one
+const int settle_frames = 4;
+const int judge_frames = 8;
+const double smoothing = 0.25;
+
+// Stepping up only happens if the bigger size is expected to leave this
+// much of the budget unused, going by its area
+const double step_up_margin = 0.75;
+
+void latency_governor_t::set_budget (double ms)
+{
+    budget_ms = ms;
+    level = frames_at_level = 0;
+}
+
+double latency_governor_t::scale (void) const
+{
+    return level_scales[level];
+}
+
+bool latency_governor_t::update (double latency_ms)
+{
+    if (budget_ms <= 0)
+        return false;
+    
+    frames_at_level++;
+    if (frames_at_level <= settle_frames)
+        return false;
+    if (frames_at_level == settle_frames + 1)
+        average_ms = latency_ms;
+    else
+        average_ms += smoothing * (latency_ms - average_ms);
+    if (frames_at_level < settle_frames + judge_frames)
+        return false;
+    
+    if (average_ms > budget_ms && level < num_levels - 1)
+        level++;
+    else if (level > 0)
+    {
+        double growth = level_scales[level - 1] / level_scales[level];
+        if (average_ms * growth * growth >= step_up_margin * budget_ms)
+            return false;
+        level--;
+    }
+    else
+        return false;
+    frames_at_level = 0;
+    return true;
+}
+
+void detect_scaled_edges (const Mat &gray, double scale, Mat &small, Mat &edges)
+{
+    {
+        TRACE_SCOPE ("resize");
+        resize (gray, small, Size (cvRound (gray.cols * scale), cvRound (gray.rows * scale)), 0, 0, INTER_AREA);
+    }
+    detect_edges (small, edges, scale);
+}
+
+void detect_scaled_contours (Mat &edges, const Mat &small, double scale, candidate_table_t &candidates)
+{
+    candidates.clear ();
+    find_candidates (edges, Point (0, 0), small, candidates, scale);
+    
+    // Back to the frame's coordinates. The bounding boxes are rounded 
+    // outwards so they still hold the whole outline.
+    double up = 1 / scale;
+    for (size_t p = 0; p < candidates.points.size (); p++)
+        candidates.points[p] = Point (cvRound (candidates.points[p].x * up), cvRound (candidates.points[p].y * up));
+    for (int i = 0; i < candidates.size (); i++)
+    {
+        candidates.area[i] *= up * up;
+        candidates.cx[i] *= up;
+        candidates.cy[i] *= up;
+        candidates.vweight[i] *= up;
+        candidates.hweight[i] *= up;
+        candidates.x0[i] = cvFloor (candidates.x0[i] * up);
+        candidates.y0[i] = cvFloor (candidates.y0[i] * up);
+        candidates.x1[i] = cvCeil (candidates.x1[i] * up);
+        candidates.y1[i] = cvCeil (candidates.y1[i] * up);
+    }
+}
@@ -25,34 +25,391 @@ THE SOFTWARE.
 #include "opencv2/highgui/highgui.hpp"
 #include "opencv2/imgproc/imgproc.hpp"
 #include <iostream>
+#include <algorithm>
+#include <string>
+#include <chrono>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
 #include "mazedemo_common.h"
+#include "trace.h"
 
 using namespace cv;
 using namespace std;
 
-static CvCapture* capture;
+bool frame_source_t::getluma (Mat &gray, frame_lease_t &lease)
+{
+    return grab () && retrieve_luma (gray, lease);
+}
+
+bool frame_source_t::retrieve (Mat &out)
+{
+    out = grabbed;
+    return !out.empty ();
+}
+
+bool frame_source_t::retrieve_luma (Mat &gray, frame_lease_t &lease)
+{
+    Mat bgr;
+    if (!retrieve (bgr))
+        return false;
+    lease.reset ();
+    gray = Mat ();
+    TRACE_SCOPE ("cvtColor");
+    cvtColor (bgr, gray, CV_BGR2GRAY);
+    return true;
+}
+
+void frame_source_t::retrieve_preview (Mat &out)
+{
+    Mat bgr;
+    if (!retrieve (bgr))
+        return;
+    // Nearest neighbour is plenty for a thumbnail and much cheaper than 
+    // averaging
+    TRACE_SCOPE ("resize");
+    resize (bgr, out, out.size (), 0, 0, INTER_NEAREST);
+}
+
+// A grab that comes back quicker than this took a frame the camera already
+// had queued, rather than waiting for a new one
+const double buffered_grab_ms = 2;
+
+// The most queued frames to skip in one grab, in case the camera is fast 
+// enough that every grab looks buffered
+const int max_skipped_frames = 8;
+
+// highgui can only decode a whole frame, so with no full decode to borrow 
+// the preview is only brought up to date every this many grabs
+const int preview_interval = 4;
+
+// Live webcam or video file, decoded by whatever backend highgui was built 
+// with. Grabbing is cheap (for most cameras it just takes the compressed 
+// frame off the driver), and only retrieving decodes.
+class capture_source_t : public frame_source_t
+{
+    CvCapture *capture;
+    bool live; // a camera, whose queued frames can be skipped
+    IplImage *decoded; // the grabbed frame once it's been retrieved, or NULL
+    int grabs_since_preview;
+public:
+    capture_source_t (CvCapture *_capture, bool _live) : 
+        capture (_capture), live (_live), decoded (NULL), grabs_since_preview (preview_interval) {}
+    ~capture_source_t (void) {cvReleaseCapture (&capture);}
+    
+    bool getframe (Mat &out)
+    {
+        return grab () && retrieve (out);
+    }
+    
+    bool grab (void)
+    {
+        TRACE_SCOPE ("cvGrabFrame");
+        decoded = NULL;
+        grabs_since_preview++;
+        for (int skipped = 0; ; skipped++)
+        {
+            timestamp_t start = chrono::steady_clock::now ();
+            if (!cvGrabFrame (capture))
+                return false;
+            double took = chrono::duration<double, milli> (chrono::steady_clock::now () - start).count ();
+            if (!live || took > buffered_grab_ms || skipped == max_skipped_frames)
+                return true;
+        }
+    }
+    
+    bool retrieve (Mat &out)
+    {
+        if (!decoded)
+        {
+            TRACE_SCOPE ("cvRetrieveFrame");
+            decoded = cvRetrieveFrame (capture);
+            if (!decoded)
+                return false;
+        }
+        out = decoded;
+        return true;
+    }
+    
+    // Just a resize if the frame's been decoded for detection already, but
+    // otherwise a full decode, so most grabs keep showing the last preview
+    void retrieve_preview (Mat &out)
+    {
+        if (!decoded && grabs_since_preview < preview_interval)
+            return;
+        grabs_since_preview = 0;
+        frame_source_t::retrieve_preview (out);
+    }
+    
+    double native_fps (void)
+    {
+        return cvGetCaptureProperty (capture, CV_CAP_PROP_FPS);
+    }
+    
+    Size frame_size (void)
+    {
+        return Size ((int)cvGetCaptureProperty (capture, CV_CAP_PROP_FRAME_WIDTH), 
+                     (int)cvGetCaptureProperty (capture, CV_CAP_PROP_FRAME_HEIGHT));
+    }
+};
 
-// Returns true on success
-bool camera_setup (void)
+// Directory of still images, played back once in filename order
+class stills_source_t : public frame_source_t
 {
-    capture = 0;
+    vector<string> paths;
+    size_t next;
+    Mat peeked; // read ahead by frame_size
     
-    capture = cvCaptureFromCAM(0); 
-    if (!capture)
+    bool read_next (Mat &out)
     {
-        cout << "NO CAMERA" << endl;
+        TRACE_SCOPE ("imread");
+        while (next < paths.size ())
+        {
+            out = imread (paths[next++]);
+            if (!out.empty ())
+                return true;
+            cout << "Skipping unreadable image " << paths[next-1] << endl;
+        }
         return false;
     }
     
-    cvSetCaptureProperty (capture, CV_CAP_PROP_FRAME_WIDTH, cfg_w);
-    cvSetCaptureProperty (capture, CV_CAP_PROP_FRAME_HEIGHT, cfg_h);
+public:
+    stills_source_t (const vector<string> &_paths) : paths (_paths), next (0) {}
+    
+    bool getframe (Mat &out)
+    {
+        if (peeked.empty ())
+            return read_next (out);
+        out = peeked;
+        peeked = Mat ();
+        return true;
+    }
     
+    // The first image's; the rest had better match
+    Size frame_size (void)
+    {
+        if (peeked.empty ())
+            read_next (peeked);
+        return peeked.size ();
+    }
+};
+
+bool list_images (const string &dir_path, vector<string> &paths)
+{
+    DIR *dir = opendir (dir_path.c_str ());
+    if (!dir)
+    {
+        cout << "Can't open directory " << dir_path << endl;
+        return false;
+    }
+    size_t first = paths.size ();
+    struct dirent *ent;
+    while ((ent = readdir (dir)) != NULL)
+    {
+        if (has_image_extension (ent->d_name))
+            paths.push_back (dir_path + "/" + ent->d_name);
+    }
+    closedir (dir);
+    sort (paths.begin () + first, paths.end ());
     return true;
 }
 
-Mat camera_getframe (void)
+static const Scalar paper (215, 220, 225);
+
+// Draws a single arrow in "marker on paper" style, roughly the size a kid
+// would draw one on the worksheet at the calibration resolution.
+static void draw_synth_arrow (Mat &canvas, Point2f org, arrowdir_t dir)
+{
+    Point2f axis (0, 0), ortho_axis (0, 0);
+    if (dir == arrow_up || dir == arrow_down)
+        axis.y = ortho_axis.x = dir == arrow_down ? 1 : -1;
+    else
+        axis.x = ortho_axis.y = dir == arrow_right ? 1 : -1;
+    
+    double len = 50*scale_len;
+    int thickness = max (2, (int)(8*scale_len));
+    Scalar ink (40, 40, 40);
+    Point2f tip = org + len * axis;
+    line (canvas, org - len * axis, tip, ink, thickness, CV_AA);
+    line (canvas, tip, tip - 0.6 * len * (axis + ortho_axis), ink, thickness, CV_AA);
+    line (canvas, tip, tip - 0.6 * len * (axis - ortho_axis), ink, thickness, CV_AA);
+}
+
+// Synthetic worksheet: rows of arrows on a sheet of paper, with one arrow 
+// "drawn in" every few frames and a little sensor noise, so the whole 
+// detection pipeline gets exercised without a camera. The sequence is the 
+// same on every run.
+class synth_source_t : public frame_source_t
+{
+    Mat sheet, noise;
+    // One arrow of each direction, drawn once, since drawing antialiased
+    // lines allocates inside OpenCV and copying doesn't
+    Mat sprites[4];
+    int sprite_radius;
+    vector<arrowdir_t> dirs;
+    int frame_num, num_frames;
+    unsigned int rng;
+    
+    unsigned int next_rand (void)
+    {
+        rng = rng * 1103515245 + 12345;
+        return (rng >> 16) & 0x7fff;
+    }
+    
+public:
+    synth_source_t (int _num_frames) : frame_num (0), num_frames (_num_frames), rng (1)
+    {
+        for (int i = 0; i < 40; i++)
+            dirs.push_back ((arrowdir_t)(next_rand () % 4));
+        noise.create (cfg_h, cfg_w, CV_8UC3);
+        sprite_radius = cvCeil (60*scale_len) + max (2, (int)(8*scale_len));
+        for (int dir = 0; dir < 4; dir++)
+        {
+            sprites[dir].create (2*sprite_radius + 1, 2*sprite_radius + 1, CV_8UC3);
+            sprites[dir].setTo (paper);
+            draw_synth_arrow (sprites[dir], Point2f (sprite_radius, sprite_radius), (arrowdir_t)dir);
+        }
+    }
+    
+    bool getframe (Mat &out)
+    {
+        if (num_frames && frame_num >= num_frames)
+            return false;
+        
+        int num_arrows = 1 + (frame_num / 8) % dirs.size ();
+        double spacing = 150*scale_len;
+        int per_row = (int)((cfg_w - spacing) / spacing);
+        
+        sheet.create (cfg_h, cfg_w, CV_8UC3);
+        sheet.setTo (paper);
+        for (int i = 0; i < num_arrows; i++)
+        {
+            Point2f org (spacing * (1 + i % per_row), spacing * (1 + i / per_row));
+            if (org.y + spacing > cfg_h)
+                break;
+            Rect where (cvRound (org.x) - sprite_radius, cvRound (org.y) - sprite_radius, 
+                        sprites[0].cols, sprites[0].rows);
+            sprites[dirs[i]].copyTo (sheet (where));
+        }
+        
+        // Cheap per-frame sensor noise
+        for (int row = 0; row < noise.rows; row++)
+        {
+            uchar *p = noise.ptr<uchar> (row);
+            for (int col = 0; col < noise.cols * 3; col++)
+                p[col] = next_rand () & 7;
+        }
+        
+        add (sheet, noise, out);
+        frame_num++;
+        return true;
+    }
+    
+    double native_fps (void) {return 30;}
+    Size frame_size (void) {return noise.size ();}
+};
+
+void fit_capture_size (frame_source_t *source)
+{
+    Size size = source->frame_size ();
+    if (size.area () == 0 || (size.width == cfg_w && size.height == cfg_h))
+        return;
+    cout << "Frames are " << size.width << "x" << size.height << ", not " << cfg_w << "x" << cfg_h 
+         << "; detecting at their size" << endl;
+    set_capture_size (size.width, size.height);
+}
+
+bool has_image_extension (const string &name)
+{
+    static const char *exts[] = {".png", ".jpg", ".jpeg", ".bmp", ".pgm", ".ppm", ".tif", ".tiff"};
+    size_t dot = name.rfind ('.');
+    if (dot == string::npos)
+        return false;
+    string ext = name.substr (dot);
+    transform (ext.begin (), ext.end (), ext.begin (), ::tolower);
+    for (size_t i = 0; i < sizeof(exts)/sizeof(*exts); i++)
+    {
+        if (ext == exts[i])
+            return true;
+    }
+    return false;
+}
+
+// Returns NULL (after printing why) if the source can't be opened.
+frame_source_t *open_frame_source (const char *spec)
 {
-     return cvQueryFrame (capture);
+    string s (spec);
+    string kind = s.substr (0, s.find (':'));
+    string arg = s.find (':') == string::npos ? "" : s.substr (s.find (':') + 1);
+    
+    if (kind == "cam")
+    {
+        CvCapture *capture = cvCaptureFromCAM (arg.empty () ? 0 : atoi (arg.c_str ()));
+        if (!capture)
+        {
+            cout << "NO CAMERA" << endl;
+            return NULL;
+        }
+        
+        cvSetCaptureProperty (capture, CV_CAP_PROP_FRAME_WIDTH, cfg_w);
+        cvSetCaptureProperty (capture, CV_CAP_PROP_FRAME_HEIGHT, cfg_h);
+        
+        return new capture_source_t (capture, true);
+    }
+    
+    if (kind == "video")
+    {
+        CvCapture *capture = cvCaptureFromFile (arg.c_str ());
+        if (!capture)
+        {
+            cout << "Can't open video " << arg << endl;
+            return NULL;
+        }
+        return new capture_source_t (capture, false);
+    }
+    
+    if (kind == "dir")
+    {
+        vector<string> paths;
+        if (!list_images (arg, paths))
+            return NULL;
+        if (paths.empty ())
+        {
+            cout << "No images in " << arg << endl;
+            return NULL;
+        }
+        return new stills_source_t (paths);
+    }
+    
+    if (kind == "synth")
+        return new synth_source_t (arg.empty () ? 0 : atoi (arg.c_str ()));
+    
+    if (kind == "v4l2")
+    {
+        if (arg.empty ())
+            arg = "/dev/video0";
+        else if (isdigit (arg[0]))
+            arg = "/dev/video" + arg;
+        return open_v4l2_source (arg.c_str ());
+    }
+    
+    if (kind == "y4m")
+        return open_y4m_source (arg.c_str ());
+    
+    if (kind == "yuv")
+    {
+        int width, height, path_start = 0;
+        if (sscanf (arg.c_str (), "%dx%d:%n", &width, &height, &path_start) < 2 || !path_start)
+        {
+            cout << "Expected yuv:WxH:PATH" << endl;
+            return NULL;
+        }
+        return open_yuv_source (arg.c_str () + path_start, width, height);
+    }
+    
+    cout << "Unknown frame source " << spec << " (expected cam[:N], video:PATH, dir:PATH, synth[:FRAMES], "
+         << "v4l2[:DEVICE], y4m:PATH or yuv:WxH:PATH)" << endl;
+    return NULL;
 }
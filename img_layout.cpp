@@ -0,0 +1,228 @@
+/*
+Mazedemo, by Max Eliaser
+
+Copyright (c) 2014 Intel Corp.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Layout: putting the arrows into reading order. They're grouped into 
+// lines of text first, then each line is read left to right. Lines are 
+// found in one sweep down the page, taking the arrows in order of their
+// vertical centre: each one joins the nearest line it overlaps enough, or
+// starts a new one. A line remembers a straight-line fit through its 
+// arrows' centres, so on a page held at a slight angle an arrow is 
+// compared with where the line actually is at that point across the page,
+// not with where it started. The whole page is skewed the same way, so a 
+// line's slope starts out as the one the lines above it had, and only 
+// drifts to its own as it gets wide enough for that to mean anything. 
+// Lines the sweep has moved well past are dropped from the search, so it's
+// O(n log n) for the sorting plus a handful of comparisons per arrow, 
+// however big the sheet.
+//
+// This used to be a single std::sort with "overlaps by 15%" as the row 
+// test inside the comparator. That isn't a strict weak ordering (A can be
+// on B's row and B on C's without A being on C's), so on a dense sheet the
+// order came out however the sort happened to visit the arrows.
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+#include "opencv2/imgproc/imgproc.hpp"
+#include "mazedemo_common.h"
+#include "trace.h"
+
+using namespace cv;
+using namespace std;
+
+// An arrow belongs to a line if they overlap vertically by at least this 
+// fraction of the smaller of their heights
+const double min_line_overlap = 0.15;
+
+// Steepest a line can run, as a slope. A few degrees of skew is all a hand-
+// held sheet ever gets; without a limit, two arrows nearly on top of each
+// other would make a line that points anywhere.
+const double max_skew = 0.15;
+
+typedef struct
+{
+    // Sums for the least-squares fit of centre y against x
+    double n, sx, sy, sxx, sxy;
+    double height_sum;
+    double bottom; // of the last arrow to join, for dropping the line
+    double a, b; // the fit, y = a + b x
+} text_line_t;
+
+// A line's own slope counts for as much as page_slope once its arrows' 
+// spread across the page (standard deviation, times the square root of 
+// their number) is this many arrow heights. Three arrows side by side are
+// nowhere near; a full line of them is well past it.
+const double slope_prior_heights = 8;
+
+// The slope is a least-squares fit pulled towards page_slope. Returns true
+// once the line's own part outweighs that.
+static bool add_to_line (text_line_t &line, const arrow_t &arrow, double page_slope)
+{
+    double x = arrow.origin[0], y = 0.5 * (arrow.vert_min + arrow.vert_max);
+    line.n++;
+    line.sx += x;
+    line.sy += y;
+    line.sxx += x * x;
+    line.sxy += x * y;
+    line.height_sum += arrow.vert_max - arrow.vert_min;
+    line.bottom = arrow.vert_max;
+    
+    double spread = line.sxx - line.sx * line.sx / line.n;
+    double covariance = line.sxy - line.sx * line.sy / line.n;
+    double prior = slope_prior_heights * line.height_sum / line.n;
+    prior *= prior;
+    line.b = max (-max_skew, min (max_skew, (covariance + prior * page_slope) / (spread + prior)));
+    line.a = (line.sy - line.b * line.sx) / line.n;
+    return spread > prior;
+}
+
+// How far arrow's centre is from line's, where line is at arrow's position
+// across the page, or -1 if they don't overlap enough for the arrow to be
+// on that line
+static double line_distance (const text_line_t &line, const arrow_t &arrow)
+{
+    double height = line.height_sum / line.n;
+    double centre = line.a + line.b * arrow.origin[0];
+    double top = max (arrow.vert_min, centre - 0.5 * height);
+    double bottom = min (arrow.vert_max, centre + 0.5 * height);
+    double smaller = min (height, arrow.vert_max - arrow.vert_min);
+    if (bottom - top < min_line_overlap * smaller)
+        return -1;
+    return fabs (0.5 * (arrow.vert_min + arrow.vert_max) - centre);
+}
+
+typedef struct
+{
+    double key1, key2;
+    int index;
+} sort_key_t;
+
+static bool operator< (const sort_key_t &l, const sort_key_t &r)
+{
+    if (l.key1 != r.key1)
+        return l.key1 < r.key1;
+    if (l.key2 != r.key2)
+        return l.key2 < r.key2;
+    return l.index < r.index;
+}
+
+// Working space, kept from call to call (one set per thread)
+static thread_local struct
+{
+    vector<sort_key_t> keys;
+    vector<text_line_t> lines;
+    vector<int> active, line_of;
+    vector<double> line_rank;
+    arrowvec_t sorted;
+} scratch;
+
+void sort_arrows (arrowvec_t &arrows)
+{
+    TRACE_SCOPE ("layout");
+    int n = arrows.size ();
+    vector<sort_key_t> &keys = scratch.keys;
+    vector<text_line_t> &lines = scratch.lines;
+    vector<int> &active = scratch.active, &line_of = scratch.line_of;
+    
+    // Down the page by vertical centre
+    keys.resize (n);
+    for (int i = 0; i < n; i++)
+    {
+        keys[i].key1 = 0.5 * (arrows[i].vert_min + arrows[i].vert_max);
+        keys[i].key2 = arrows[i].origin[0];
+        keys[i].index = i;
+    }
+    sort (keys.begin (), keys.end ());
+    
+    lines.clear ();
+    active.clear ();
+    line_of.resize (n);
+    double page_slope = 0;
+    for (int k = 0; k < n; k++)
+    {
+        const arrow_t &arrow = arrows[keys[k].index];
+        
+        // Nothing from here on down can reach a line that ended more than a
+        // line's height ago
+        for (size_t j = 0; j < active.size (); )
+        {
+            const text_line_t &line = lines[active[j]];
+            if (line.bottom + line.height_sum / line.n < arrow.vert_min)
+            {
+                active[j] = active.back ();
+                active.pop_back ();
+            }
+            else
+                j++;
+        }
+        
+        // The nearest line it could be on
+        int best = -1;
+        double best_distance = 0;
+        for (size_t j = 0; j < active.size (); j++)
+        {
+            double distance = line_distance (lines[active[j]], arrow);
+            if (distance >= 0 && (best < 0 || distance < best_distance))
+            {
+                best = active[j];
+                best_distance = distance;
+            }
+        }
+        if (best < 0)
+        {
+            best = lines.size ();
+            text_line_t line;
+            memset (&line, 0, sizeof(line));
+            lines.push_back (line);
+            active.push_back (best);
+        }
+        if (add_to_line (lines[best], arrow, page_slope))
+            page_slope = lines[best].b;
+        line_of[keys[k].index] = best;
+    }
+    
+    // Lines top to bottom, measured at the same point across the page so 
+    // the skew doesn't reorder them, then each one left to right
+    double mid_x = 0;
+    for (int i = 0; i < n; i++)
+        mid_x += arrows[i].origin[0];
+    mid_x = n ? mid_x / n : 0;
+    vector<double> &line_rank = scratch.line_rank;
+    line_rank.resize (lines.size ());
+    for (size_t l = 0; l < lines.size (); l++)
+        line_rank[l] = lines[l].a + lines[l].b * mid_x;
+    for (int i = 0; i < n; i++)
+    {
+        keys[i].key1 = line_rank[line_of[i]];
+        keys[i].key2 = arrows[i].origin[0];
+        keys[i].index = i;
+    }
+    sort (keys.begin (), keys.end ());
+    
+    arrowvec_t &sorted = scratch.sorted;
+    sorted.resize (n);
+    for (int k = 0; k < n; k++)
+        sorted[k] = arrows[keys[k].index];
+    arrows.swap (sorted);
+}
@@ -0,0 +1,628 @@
+/*
+Mazedemo, by Max Eliaser
+
+Copyright (c) 2014 Intel Corp.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Luma-only capture. Detection only ever looks at brightness, and most 
+// webcams and raw video files already store that as its own plane, so 
+// going through a BGR decode and cvtColor just to get back to it is wasted 
+// work (plus a full copy of the frame.) These sources hand out a cv::Mat 
+// header pointing straight at the Y plane instead.
+//
+// v4l2 maps the driver's capture buffers. A buffer handed out by retrieve_luma
+// isn't given back to the driver until its lease is dropped, so it can sit
+// in the detection pipeline for as long as it needs to. If that would leave
+// the driver with no buffers to fill, the frame is copied out instead. 
+// YUYV has no Y plane to point at, so its luma is pulled out into a small 
+// pool of buffers of our own, which go out on lease the same way. 
+// grab takes the newest buffer the driver has filled and gives the older 
+// ones straight back, so a slow consumer never works through a backlog.
+//
+// y4m and yuv map the whole file, which stays mapped until the source is 
+// deleted, so their leases are always empty.
+
+#include "opencv2/imgproc/imgproc.hpp"
+#include <iostream>
+#include <string>
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/videodev2.h>
+#include "mazedemo_common.h"
+#include "trace.h"
+
+using namespace cv;
+using namespace std;
+
+// Formats we can take the Y plane of without touching the pixels, in order
+// of preference, and then YUYV as the fallback nearly every webcam has
+static const uint32_t v4l2_formats[] = {V4L2_PIX_FMT_GREY, V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_YUV420, V4L2_PIX_FMT_YUYV};
+
+const int v4l2_num_buffers = 8;
+
+// How long to wait for the camera before giving up on it
+const int v4l2_timeout_ms = 2000;
+
+static int xioctl (int fd, unsigned long request, void *arg)
+{
+    int ret;
+    do
+        ret = ioctl (fd, request, arg);
+    while (ret == -1 && errno == EINTR);
+    return ret;
+}
+
+// A gray preview straight from the Y plane, with no colour decode
+static void preview_luma (const Mat &y_plane, Mat &scratch, Mat &out)
+{
+    TRACE_SCOPE ("resize");
+    resize (y_plane, scratch, out.size (), 0, 0, INTER_NEAREST);
+    cvtColor (scratch, out, CV_GRAY2BGR);
+}
+
+class v4l2_source_t : public frame_source_t
+{
+    typedef struct
+    {
+        void *start;
+        size_t length;
+    } buffer_t;
+    
+    int fd;
+    uint32_t format;
+    int width, height, stride;
+    double fps;
+    vector<buffer_t> buffers;
+    atomic<int> leased; // buffers out on lease rather than with the driver
+    int held; // the grabbed buffer, not yet given back or handed out, or -1
+    bool converted; // bgr holds the grabbed frame
+    Mat bgr, preview_scratch, preview_gray, packed;
+    
+    // Luma pulled out of YUYV frames, handed out on lease like the capture
+    // buffers and reused once the lease is dropped
+    Mat yuyv_luma[v4l2_num_buffers];
+    atomic<bool> yuyv_luma_leased[v4l2_num_buffers];
+    
+    // Index of the next filled buffer, or -1 if there's none within 
+    // timeout_ms
+    int dequeue (int timeout_ms)
+    {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll (&pfd, 1, timeout_ms) <= 0)
+            return -1;
+        
+        struct v4l2_buffer buf;
+        memset (&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        if (xioctl (fd, VIDIOC_DQBUF, &buf) == -1)
+            return -1;
+        return buf.index;
+    }
+    
+    void requeue (int index)
+    {
+        struct v4l2_buffer buf;
+        memset (&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = index;
+        xioctl (fd, VIDIOC_QBUF, &buf);
+    }
+    
+    // The whole buffer as one image, the way cvtColor wants it
+    Mat whole_frame (int index)
+    {
+        switch (format)
+        {
+            case V4L2_PIX_FMT_YUYV:
+                return Mat (height, width, CV_8UC2, buffers[index].start, stride);
+            case V4L2_PIX_FMT_GREY:
+                return Mat (height, width, CV_8UC1, buffers[index].start, stride);
+            case V4L2_PIX_FMT_YUV420:
+                if (stride != width)
+                    return packed_i420 (index);
+                // fall through
+            default: // Y plane followed by chroma at half the height
+                return Mat (height * 3 / 2, width, CV_8UC1, buffers[index].start, stride);
+        }
+    }
+    
+    // I420 with padded rows has its chroma planes padded to half the luma 
+    // stride, which no one Mat header can describe, so the planes are 
+    // copied into a packed buffer first
+    Mat packed_i420 (int index)
+    {
+        int chroma_width = width / 2, chroma_height = height / 2, chroma_stride = stride / 2;
+        unsigned char *y = (unsigned char *)buffers[index].start;
+        unsigned char *u = y + (size_t)height * stride;
+        unsigned char *v = u + (size_t)chroma_height * chroma_stride;
+        packed.create (height * 3 / 2, width, CV_8UC1);
+        unsigned char *packed_u = packed.ptr (height);
+        unsigned char *packed_v = packed_u + chroma_height * chroma_width;
+        Mat (height, width, CV_8UC1, y, stride).copyTo (packed.rowRange (0, height));
+        Mat (chroma_height, chroma_width, CV_8UC1, u, chroma_stride).copyTo (Mat (chroma_height, chroma_width, CV_8UC1, packed_u));
+        Mat (chroma_height, chroma_width, CV_8UC1, v, chroma_stride).copyTo (Mat (chroma_height, chroma_width, CV_8UC1, packed_v));
+        return packed;
+    }
+    
+    // A YUYV luma buffer nobody's using, or -1 if they're all out
+    int free_yuyv_luma (void)
+    {
+        for (int i = 0; i < v4l2_num_buffers; i++)
+        {
+            if (!yuyv_luma_leased[i].load ())
+                return i;
+        }
+        return -1;
+    }
+    
+public:
+    v4l2_source_t (int _fd, uint32_t _format, int _width, int _height, int _stride, double _fps)
+        : fd (_fd), format (_format), width (_width), height (_height), stride (_stride), fps (_fps), 
+          leased (0), held (-1), converted (false)
+    {
+        for (int i = 0; i < v4l2_num_buffers; i++)
+            yuyv_luma_leased[i] = false;
+    }
+    
+    ~v4l2_source_t (void)
+    {
+        enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        xioctl (fd, VIDIOC_STREAMOFF, &type);
+        for (size_t i = 0; i < buffers.size (); i++)
+            munmap (buffers[i].start, buffers[i].length);
+        close (fd);
+    }
+    
+    // Maps and queues the capture buffers and starts streaming
+    bool start (void)
+    {
+        struct v4l2_requestbuffers req;
+        memset (&req, 0, sizeof(req));
+        req.count = v4l2_num_buffers;
+        req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        req.memory = V4L2_MEMORY_MMAP;
+        if (xioctl (fd, VIDIOC_REQBUFS, &req) == -1 || req.count < 2)
+            return false;
+        
+        for (unsigned i = 0; i < req.count; i++)
+        {
+            struct v4l2_buffer buf;
+            memset (&buf, 0, sizeof(buf));
+            buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            buf.memory = V4L2_MEMORY_MMAP;
+            buf.index = i;
+            if (xioctl (fd, VIDIOC_QUERYBUF, &buf) == -1)
+                return false;
+            buffer_t mapped;
+            mapped.length = buf.length;
+            mapped.start = mmap (NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buf.m.offset);
+            if (mapped.start == MAP_FAILED)
+                return false;
+            buffers.push_back (mapped);
+            requeue (i);
+        }
+        
+        enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        return xioctl (fd, VIDIOC_STREAMON, &type) != -1;
+    }
+    
+    bool getframe (Mat &out)
+    {
+        return grab () && retrieve (out);
+    }
+    
+    // Takes the newest buffer the driver has filled, and gives back any 
+    // older ones unlooked at
+    bool grab (void)
+    {
+        TRACE_SCOPE ("v4l2_grab");
+        if (held >= 0)
+            requeue (held);
+        converted = false;
+        held = dequeue (v4l2_timeout_ms);
+        int newer;
+        while (held >= 0 && (newer = dequeue (0)) >= 0)
+        {
+            requeue (held);
+            held = newer;
+        }
+        return held >= 0;
+    }
+    
+    bool retrieve (Mat &out)
+    {
+        if (held < 0)
+            return false;
+        if (!converted)
+        {
+            TRACE_SCOPE ("v4l2_retrieve");
+            Mat in = whole_frame (held);
+            switch (format)
+            {
+                case V4L2_PIX_FMT_YUYV:
+                    cvtColor (in, bgr, CV_YUV2BGR_YUYV);
+                    break;
+                case V4L2_PIX_FMT_NV12:
+                    cvtColor (in, bgr, CV_YUV2BGR_NV12);
+                    break;
+                case V4L2_PIX_FMT_YUV420:
+                    cvtColor (in, bgr, CV_YUV2BGR_I420);
+                    break;
+                default:
+                    cvtColor (in, bgr, CV_GRAY2BGR);
+            }
+            converted = true;
+        }
+        out = bgr;
+        return true;
+    }
+    
+    bool retrieve_luma (Mat &gray, frame_lease_t &lease)
+    {
+        if (held < 0)
+            return false;
+        TRACE_SCOPE ("v4l2_retrieve_luma");
+        int index = held;
+        held = -1;
+        
+        // YUYV interleaves the chroma with the luma, so the best we can do 
+        // is one strided pass pulling the Y bytes out, into a buffer of our
+        // own that goes out on lease in place of the capture buffer
+        if (format == V4L2_PIX_FMT_YUYV)
+        {
+            Mat yuyv = whole_frame (index);
+            int slot = free_yuyv_luma ();
+            gray = slot >= 0 ? yuyv_luma[slot] : Mat ();
+            gray.create (height, width, CV_8UC1);
+            if (slot >= 0)
+                yuyv_luma[slot] = gray;
+            int from_to[] = {0, 0};
+            mixChannels (&yuyv, 1, &gray, 1, from_to, 1);
+            requeue (index);
+            if (slot < 0)
+            {
+                // Everything's out on lease; this one's a new buffer of its
+                // own, and nothing needs to be given back
+                lease.reset ();
+                return true;
+            }
+            yuyv_luma_leased[slot] = true;
+            lease = frame_lease_t (gray.data, [this, slot] (void *)
+            {
+                yuyv_luma_leased[slot] = false;
+            });
+            return true;
+        }
+        
+        Mat y_plane (height, width, CV_8UC1, buffers[index].start, stride);
+        if (leased.load () + 1 >= (int)buffers.size ())
+        {
+            // Everything else is still out on lease; keep this one with the
+            // driver so it doesn't run dry
+            gray = y_plane.clone ();
+            requeue (index);
+            lease.reset ();
+            return true;
+        }
+        
+        leased++;
+        gray = y_plane;
+        lease = frame_lease_t (buffers[index].start, [this, index] (void *)
+        {
+            requeue (index);
+            leased--;
+        });
+        return true;
+    }
+    
+    void retrieve_preview (Mat &out)
+    {
+        if (held < 0)
+            return;
+        if (format == V4L2_PIX_FMT_YUYV)
+        {
+            // Every pixel pair starts with a Y byte, so shrinking the pairs
+            // leaves one at the start of each
+            TRACE_SCOPE ("resize");
+            resize (whole_frame (held), preview_scratch, out.size (), 0, 0, INTER_NEAREST);
+            preview_gray.create (out.size (), CV_8UC1);
+            int from_to[] = {0, 0};
+            mixChannels (&preview_scratch, 1, &preview_gray, 1, from_to, 1);
+            cvtColor (preview_gray, out, CV_GRAY2BGR);
+            return;
+        }
+        preview_luma (Mat (height, width, CV_8UC1, buffers[held].start, stride), preview_scratch, out);
+    }
+    
+    bool has_luma (void) {return true;}
+    double native_fps (void) {return fps;}
+    Size frame_size (void) {return Size (width, height);}
+};
+
+frame_source_t *open_v4l2_source (const char *device)
+{
+    int fd = open (device, O_RDWR | O_NONBLOCK);
+    if (fd == -1)
+    {
+        cout << "Can't open " << device << ": " << strerror (errno) << endl;
+        return NULL;
+    }
+    
+    struct v4l2_capability cap;
+    if (xioctl (fd, VIDIOC_QUERYCAP, &cap) == -1 || 
+        !(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE) || !(cap.capabilities & V4L2_CAP_STREAMING))
+    {
+        cout << device << " is not a streaming capture device" << endl;
+        close (fd);
+        return NULL;
+    }
+    
+    struct v4l2_format fmt;
+    bool found = false;
+    for (size_t i = 0; i < sizeof(v4l2_formats)/sizeof(*v4l2_formats) && !found; i++)
+    {
+        memset (&fmt, 0, sizeof(fmt));
+        fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        fmt.fmt.pix.width = cfg_w;
+        fmt.fmt.pix.height = cfg_h;
+        fmt.fmt.pix.pixelformat = v4l2_formats[i];
+        fmt.fmt.pix.field = V4L2_FIELD_NONE;
+        // The driver substitutes a format it does support if it has to
+        found = xioctl (fd, VIDIOC_S_FMT, &fmt) != -1 && fmt.fmt.pix.pixelformat == v4l2_formats[i];
+    }
+    if (!found)
+    {
+        cout << device << " has no YUV or grayscale format" << endl;
+        close (fd);
+        return NULL;
+    }
+    
+    double fps = 0;
+    struct v4l2_streamparm parm;
+    memset (&parm, 0, sizeof(parm));
+    parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (xioctl (fd, VIDIOC_G_PARM, &parm) != -1 && parm.parm.capture.timeperframe.numerator)
+        fps = (double)parm.parm.capture.timeperframe.denominator / parm.parm.capture.timeperframe.numerator;
+    
+    v4l2_source_t *source = new v4l2_source_t (fd, fmt.fmt.pix.pixelformat, fmt.fmt.pix.width, 
+                                               fmt.fmt.pix.height, fmt.fmt.pix.bytesperline, fps);
+    if (!source->start ())
+    {
+        cout << "Can't start streaming from " << device << ": " << strerror (errno) << endl;
+        delete source;
+        return NULL;
+    }
+    return source;
+}
+
+// A Y4M or raw I420 file, mapped into memory. Each frame's Y plane comes 
+// first, followed by chroma_size bytes we skip over (or use for getframe.)
+class yuv_file_source_t : public frame_source_t
+{
+    unsigned char *base;
+    size_t size, pos;
+    bool y4m; // frames start with a FRAME line
+    bool i420; // chroma is 4:2:0, which getframe can convert
+    int width, height;
+    size_t chroma_size;
+    double fps;
+    unsigned char *frame; // the grabbed frame's Y plane, or NULL
+    bool converted; // bgr holds it
+    Mat bgr, preview_scratch;
+    
+    // Finds the next frame's Y plane, or returns NULL at the end of the file
+    unsigned char *next_frame (void)
+    {
+        if (y4m)
+        {
+            if (pos + 5 > size || memcmp (base + pos, "FRAME", 5))
+                return NULL;
+            unsigned char *eol = (unsigned char *)memchr (base + pos, '\n', size - pos);
+            if (!eol)
+                return NULL;
+            pos = eol + 1 - base;
+        }
+        size_t frame_size = (size_t)width * height + chroma_size;
+        if (pos + frame_size > size)
+            return NULL;
+        unsigned char *frame = base + pos;
+        pos += frame_size;
+        return frame;
+    }
+    
+public:
+    yuv_file_source_t (unsigned char *_base, size_t _size, size_t header_size, bool _y4m, bool _i420, 
+                       int _width, int _height, size_t _chroma_size, double _fps)
+        : base (_base), size (_size), pos (header_size), y4m (_y4m), i420 (_i420), 
+          width (_width), height (_height), chroma_size (_chroma_size), fps (_fps), 
+          frame (NULL), converted (false) {}
+    ~yuv_file_source_t (void) {munmap (base, size);}
+    
+    bool getframe (Mat &out)
+    {
+        return grab () && retrieve (out);
+    }
+    
+    bool grab (void)
+    {
+        frame = next_frame ();
+        converted = false;
+        return frame != NULL;
+    }
+    
+    bool retrieve (Mat &out)
+    {
+        if (!frame)
+            return false;
+        if (!converted)
+        {
+            TRACE_SCOPE ("yuv_retrieve");
+            if (i420)
+                cvtColor (Mat (height * 3 / 2, width, CV_8UC1, frame), bgr, CV_YUV2BGR_I420);
+            else
+                cvtColor (Mat (height, width, CV_8UC1, frame), bgr, CV_GRAY2BGR);
+            converted = true;
+        }
+        out = bgr;
+        return true;
+    }
+    
+    bool retrieve_luma (Mat &gray, frame_lease_t &lease)
+    {
+        if (!frame)
+            return false;
+        gray = Mat (height, width, CV_8UC1, frame);
+        lease.reset ();
+        return true;
+    }
+    
+    void retrieve_preview (Mat &out)
+    {
+        if (frame)
+            preview_luma (Mat (height, width, CV_8UC1, frame), preview_scratch, out);
+    }
+    
+    bool has_luma (void) {return true;}
+    double native_fps (void) {return fps;}
+    Size frame_size (void) {return Size (width, height);}
+};
+
+// Maps a whole file copy-on-write, so nothing that writes into a frame by 
+// mistake can touch the file
+static unsigned char *map_file (const char *path, size_t &size)
+{
+    int fd = open (path, O_RDONLY);
+    if (fd == -1)
+    {
+        cout << "Can't open " << path << ": " << strerror (errno) << endl;
+        return NULL;
+    }
+    struct stat st;
+    void *base = MAP_FAILED;
+    if (fstat (fd, &st) != -1 && st.st_size > 0)
+    {
+        size = st.st_size;
+        base = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    }
+    close (fd);
+    if (base == MAP_FAILED)
+    {
+        cout << "Can't map " << path << endl;
+        return NULL;
+    }
+    madvise (base, size, MADV_SEQUENTIAL);
+    return (unsigned char *)base;
+}
+
+frame_source_t *open_y4m_source (const char *path)
+{
+    size_t size;
+    unsigned char *base = map_file (path, size);
+    if (!base)
+        return NULL;
+    
+    // YUV4MPEG2 W<width> H<height> F<num>:<den> C<chroma> ..., all on one line
+    unsigned char *eol = (unsigned char *)memchr (base, '\n', size);
+    if (size < 10 || memcmp (base, "YUV4MPEG2 ", 10) || !eol)
+    {
+        cout << path << " is not a Y4M file" << endl;
+        munmap (base, size);
+        return NULL;
+    }
+    string header ((char *)base, eol - base);
+    int width = 0, height = 0;
+    double fps = 0;
+    string chroma = "420";
+    size_t start = 0;
+    while (start < header.size ())
+    {
+        size_t end = header.find (' ', start);
+        if (end == string::npos)
+            end = header.size ();
+        string param = header.substr (start, end - start);
+        if (param.size () > 1)
+        {
+            if (param[0] == 'W')
+                width = atoi (param.c_str () + 1);
+            else if (param[0] == 'H')
+                height = atoi (param.c_str () + 1);
+            else if (param[0] == 'C')
+                chroma = param.substr (1);
+            else if (param[0] == 'F')
+            {
+                int num = 0, den = 0;
+                if (sscanf (param.c_str () + 1, "%d:%d", &num, &den) == 2 && den)
+                    fps = (double)num / den;
+            }
+        }
+        start = end + 1;
+    }
+    
+    size_t chroma_w = (width + 1) / 2, chroma_h = (height + 1) / 2, chroma_size;
+    if (chroma.compare (0, 4, "mono") == 0)
+        chroma_size = 0;
+    else if (chroma.compare (0, 3, "420") == 0)
+        chroma_size = 2 * chroma_w * chroma_h;
+    else if (chroma.compare (0, 3, "422") == 0)
+        chroma_size = 2 * chroma_w * height;
+    else if (chroma.compare (0, 3, "444") == 0)
+        chroma_size = 2 * (size_t)width * height;
+    else
+    {
+        cout << path << ": unsupported Y4M colour space " << chroma << endl;
+        munmap (base, size);
+        return NULL;
+    }
+    if (width <= 0 || height <= 0)
+    {
+        cout << path << ": bad Y4M frame size" << endl;
+        munmap (base, size);
+        return NULL;
+    }
+    
+    bool i420 = chroma.compare (0, 3, "420") == 0 && width % 2 == 0 && height % 2 == 0;
+    return new yuv_file_source_t (base, size, eol + 1 - base, true, i420, width, height, chroma_size, fps);
+}
+
+frame_source_t *open_yuv_source (const char *path, int width, int height)
+{
+    if (width <= 0 || height <= 0 || width % 2 || height % 2)
+    {
+        cout << "Raw YUV needs an even frame size" << endl;
+        return NULL;
+    }
+    size_t size;
+    unsigned char *base = map_file (path, size);
+    if (!base)
+        return NULL;
+    return new yuv_file_source_t (base, size, 0, false, true, width, height, (size_t)width * height / 2, 0);
+}
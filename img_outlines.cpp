@@ -0,0 +1,296 @@
+/*
+Mazedemo, by Max Eliaser
+
+Copyright (c) 2014 Intel Corp.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// The outer outlines of the blobs in the edge image and their simplified 
+// versions, as findContours (CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE) and 
+// approxPolyDP would give them, but written into storage kept from call to
+// call. OpenCV's make a new contour store, scanner and point buffers every
+// time, which is most of what's left allocating on a frame.
+//
+// The tracing is Suzuki and Abe's border following, done the way OpenCV 
+// 2.4 does it, so the outlines come out the same point for point and in the
+// same order. Like findContours, it clobbers the image: the edge of it is 
+// cleared, every other pixel becomes 0 or 1, and traced borders get marked.
+
+#include "opencv2/imgproc/imgproc.hpp"
+#include <math.h>
+#include "mazedemo_common.h"
+#include "trace.h"
+
+using namespace cv;
+using namespace std;
+
+// Border pixels get marked 2, or this if the border leaves them heading 
+// right (so the scan knows it's coming out of the blob there)
+const signed char left_mark = 2, right_mark = 2 | -128;
+
+// Steps to the 8 neighbours, anticlockwise from the right, as OpenCV numbers
+// them (with y going down)
+static const Point step_dirs[8] = 
+{
+    Point (1, 0), Point (1, -1), Point (0, -1), Point (-1, -1), 
+    Point (-1, 0), Point (-1, 1), Point (0, 1), Point (1, 1)
+};
+
+// Follows the outer border starting at the blob's top left pixel p, which
+// is at pt, appending its corners to outlines.points
+static void follow_border (signed char *p, int step, Point pt, vector<Point> &points)
+{
+    // Twice round, so stepping on from any direction never needs wrapping
+    int deltas[16];
+    for (int s = 0; s < 16; s++)
+        deltas[s] = step_dirs[s & 7].x + step_dirs[s & 7].y * step;
+    
+    // The first neighbour clockwise from the left
+    int s = 4, s_end = 4;
+    signed char *first;
+    do
+    {
+        s = (s - 1) & 7;
+        first = p + deltas[s];
+        if (*first)
+            break;
+    } while (s != s_end);
+    
+    if (s == s_end)
+    {
+        // A single pixel
+        *p = right_mark;
+        points.push_back (pt);
+        return;
+    }
+    
+    // Then round anticlockwise from where each step came from, keeping only
+    // the points where the direction changes
+    signed char *cur = p, *next;
+    int prev_s = s ^ 4;
+    for (;;)
+    {
+        s_end = s;
+        do
+            next = cur + deltas[++s];
+        while (!*next);
+        s &= 7;
+        
+        if ((unsigned)(s - 1) < (unsigned)s_end)
+            *cur = right_mark;
+        else if (*cur == 1)
+            *cur = left_mark;
+        
+        if (s != prev_s)
+        {
+            points.push_back (pt);
+            prev_s = s;
+        }
+        pt += step_dirs[s];
+        
+        if (next == p && cur == first)
+            break;
+        cur = next;
+        s = (s + 4) & 7;
+    }
+}
+
+void trace_outlines (Mat &edges, Point offset, outline_list_t &outlines)
+{
+    TRACE_SCOPE ("trace_outlines");
+    outlines.points.clear ();
+    outlines.start.clear ();
+    outlines.count.clear ();
+    int rows = edges.rows, cols = edges.cols;
+    if (rows < 3 || cols < 3)
+        return;
+    
+    for (int y = 0; y < rows; y++)
+    {
+        uchar *e = edges.ptr<uchar> (y);
+        if (y == 0 || y == rows - 1)
+        {
+            memset (e, 0, cols);
+            continue;
+        }
+        e[0] = e[cols - 1] = 0;
+        for (int x = 1; x < cols - 1; x++)
+            e[x] = e[x] ? 1 : 0;
+    }
+    
+    // Going along each row, a 0 followed by a 1 is the top left of a blob
+    // nobody has traced yet. It's an outer one unless the last border the
+    // scan went into (and not back out of) was the left side of another.
+    int step = (int)edges.step;
+    for (int y = 1; y < rows - 1; y++)
+    {
+        signed char *row = (signed char *)edges.ptr<uchar> (y);
+        int prev = 0, last_border = 0;
+        for (int x = 1; x < cols; x++)
+        {
+            int p = row[x];
+            if (p == prev)
+                continue;
+            if (prev == 0 && p == 1)
+            {
+                if (last_border <= 0)
+                {
+                    outlines.start.push_back (outlines.points.size ());
+                    follow_border (row + x, step, Point (x, y) + offset, outlines.points);
+                    outlines.count.push_back (outlines.points.size () - outlines.start.back ());
+                    prev = row[x];
+                    continue;
+                }
+            }
+            else if (p == 0 && prev > 1)
+                last_border = prev;
+            prev = p;
+            if (p & ~1)
+                last_border = p;
+        }
+    }
+    
+    // findContours gives the last one found first
+    reverse (outlines.start.begin (), outlines.start.end ());
+    reverse (outlines.count.begin (), outlines.count.end ());
+}
+
+// Douglas-Peucker on a closed outline, step for step as approxPolyDP does
+// it: start from the two points furthest apart, split each half at the 
+// point furthest from the line across it until it's within epsilon, then
+// drop the points left sitting on nearly straight lines.
+void simplify_outline (const Point *src, int count, double epsilon, vector<Point> &dst)
+{
+    static thread_local vector<Range> stack;
+    dst.resize (count);
+    stack.clear ();
+    if (count == 0)
+        return;
+    
+    double eps = epsilon * epsilon;
+    int pos = 0, new_count = 0;
+    Range slice (0, 0), right_slice (0, 0);
+    Point start_pt (-1000000, -1000000), end_pt (0, 0), pt (0, 0);
+    auto read_pt = [&] (const Point *from, Point &to) 
+    {
+        to = from[pos];
+        if (++pos >= count)
+            pos = 0;
+    };
+    
+    // Three rounds of finding the point furthest from the last one found
+    bool le_eps = false;
+    for (int i = 0; i < 3; i++)
+    {
+        double max_dist = 0;
+        pos = (pos + right_slice.start) % count;
+        read_pt (src, start_pt);
+        for (int j = 1; j < count; j++)
+        {
+            read_pt (src, pt);
+            double dx = pt.x - start_pt.x, dy = pt.y - start_pt.y;
+            double dist = dx * dx + dy * dy;
+            if (dist > max_dist)
+            {
+                max_dist = dist;
+                right_slice.start = j;
+            }
+        }
+        le_eps = max_dist <= eps;
+    }
+    if (!le_eps)
+    {
+        right_slice.end = slice.start = pos % count;
+        slice.end = right_slice.start = (right_slice.start + slice.start) % count;
+        stack.push_back (right_slice);
+        stack.push_back (slice);
+    }
+    else
+        dst[new_count++] = start_pt;
+    
+    while (!stack.empty ())
+    {
+        slice = stack.back ();
+        stack.pop_back ();
+        end_pt = src[slice.end];
+        pos = slice.start;
+        read_pt (src, start_pt);
+        if (pos != slice.end)
+        {
+            double dx = end_pt.x - start_pt.x, dy = end_pt.y - start_pt.y;
+            double max_dist = 0;
+            while (pos != slice.end)
+            {
+                read_pt (src, pt);
+                double dist = fabs ((pt.y - start_pt.y) * dx - (pt.x - start_pt.x) * dy);
+                if (dist > max_dist)
+                {
+                    max_dist = dist;
+                    right_slice.start = (pos + count - 1) % count;
+                }
+            }
+            le_eps = max_dist * max_dist <= eps * (dx * dx + dy * dy);
+        }
+        else
+        {
+            le_eps = true;
+            start_pt = src[slice.start];
+        }
+        
+        if (le_eps)
+            dst[new_count++] = start_pt;
+        else
+        {
+            right_slice.end = slice.end;
+            slice.end = right_slice.start;
+            stack.push_back (right_slice);
+            stack.push_back (slice);
+        }
+    }
+    
+    // The clean-up, going round the result in place
+    count = new_count;
+    pos = count - 1;
+    read_pt (&dst[0], start_pt);
+    int wpos = pos;
+    read_pt (&dst[0], pt);
+    for (int i = 0; i < count && new_count > 2; i++)
+    {
+        read_pt (&dst[0], end_pt);
+        double dx = end_pt.x - start_pt.x, dy = end_pt.y - start_pt.y;
+        double dist = fabs ((pt.x - start_pt.x) * dy - (pt.y - start_pt.y) * dx);
+        double successive_inner_product = (pt.x - start_pt.x) * (end_pt.x - pt.x) + (pt.y - start_pt.y) * (end_pt.y - pt.y);
+        if (dist * dist <= 0.5 * eps * (dx * dx + dy * dy) && dx != 0 && dy != 0 && successive_inner_product >= 0)
+        {
+            new_count--;
+            dst[wpos] = start_pt = end_pt;
+            if (++wpos >= count)
+                wpos = 0;
+            read_pt (&dst[0], pt);
+            i++;
+            continue;
+        }
+        dst[wpos] = start_pt = pt;
+        if (++wpos >= count)
+            wpos = 0;
+        pt = end_pt;
+    }
+    dst.resize (new_count);
+}
@@ -27,33 +27,29 @@ THE SOFTWARE.
 #include <iostream>
 #include <stdio.h>
 #include <stdlib.h>
-#include <thread>
 #include "mazedemo_common.h"
+#include "trace.h"
 
 using namespace cv;
 using namespace std;
 
-// I hate C++
-bool process_done; 
-arrowvec_t process_output; 
+int cfg_w = 1280, cfg_h = 720;
+double scale_len = (double)cfg_h/(double)base_h;
+double scale_area = (double)(cfg_w*cfg_h)/(double)base_area;
 
-const double arrow_scale = 10*scale_len;
-
-// Sort arrows right to left, top to bottom.
-static bool compare_arrow (arrow_t a, arrow_t b)
+void set_capture_size (int width, int height)
 {
-    // Check if they're in different rows first
-    if (a.vert_max - 0.15 * (a.vert_max - a.vert_min) < b.vert_min)
-        return true;
-    
-    if (a.vert_min > b.vert_max - 0.15 * (b.vert_max - b.vert_min))
-        return false;
-    
-    return a.origin[0] < b.origin[0];
+    cfg_w = width;
+    cfg_h = height;
+    scale_len = (double)cfg_h/(double)base_h;
+    scale_area = (double)(cfg_w*cfg_h)/(double)base_area;
 }
 
+detect_config_t detect_config;
+
 static void draw_arrow (Mat &canvas, Scalar color, Point2f &org, Point2f &axis, Point2f &ortho_axis)
 {
+    double arrow_scale = 10*scale_len;
     #define DRAWPT(x,y) org + arrow_scale * ((x * axis) + (y * ortho_axis))
     Point2f arrow_start = DRAWPT (-1, 0),
             arrow_tip = DRAWPT (1, 0),
@@ -65,102 +61,300 @@ static void draw_arrow (Mat &canvas, Scalar color, Point2f &org, Point2f &axis,
     line (canvas, arrow_right, arrow_left, color, 2, CV_AA);
 }
 
-/** @function do_process */
-void do_process (Mat process_in)
+// Use the Canny edge-detect filter, then dilate the image to merge the 
+// detected edges a bit. scale is the size of gray relative to the full 
+// camera frame, which the dilation is sized for.
+void detect_edges (const Mat &gray, Mat &edges, double scale)
 {
-    vector<vector<Point> > contours_unfiltered, contours;
-    vector<Vec4i> hierarchy;
-
-    // Use the Canny edge-detect filter, then dilate the image to merge the 
-    // detected edges a bit.
-    Mat canny_out;
-    Canny (process_in, canny_out, 30, 60, 3);
+    int dilate_size = max (1, cvRound (3 * scale));
     #define GETELEMENT(sz) getStructuringElement(2, Size( 2*sz + 1, 2*sz+1 ), Point( sz, sz ) )
-    dilate (canny_out, canny_out, GETELEMENT(3));
+    // Only a few sizes ever get used, so each is made once
+    static thread_local Mat elements[8];
+    Mat element = dilate_size < 8 ? elements[dilate_size] : Mat ();
+    if (element.empty ())
+    {
+        element = GETELEMENT(dilate_size);
+        if (dilate_size < 8)
+            elements[dilate_size] = element;
+    }
     
-    // Find contours and isolate the ones we're interested in
-    findContours (canny_out, contours_unfiltered, hierarchy, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE);
-    for (auto i = contours_unfiltered.begin (); i != contours_unfiltered.end (); i++)
+    if (detect_config.edge_threads > 1 && detect_striped_edges (gray, edges, element, detect_config.edge_threads))
+        return;
+    static thread_local vector<int> stack;
     {
-        // Simplify the contour for efficiency
-        vector<Point> tmp_contour;
-        approxPolyDP (*i, tmp_contour, 2, true);
-        
-        // Filter out the contours in the wrong size range
-        double area = contourArea (tmp_contour);
-        if (area < 800*scale_area || area > 25600*scale_area)
-            continue;
+        TRACE_SCOPE ("Canny");
+        canny_edges (gray, edges, stack);
+    }
+    if (!dilate_edges (edges, edges, element, 0, edges.rows, 0, edges.rows))
+    {
+        // Not an ellipse, so OpenCV's dilate, which wants just 0 and 255
+        TRACE_SCOPE ("dilate");
+        threshold (edges, edges, 254, 255, THRESH_BINARY);
+        dilate (edges, edges, element);
+    }
+}
+
+Mat reuse_buffer (Mat &buf, Size size, int type)
+{
+    size_t bytes = (size_t)size.area () * CV_ELEM_SIZE (type);
+    if (buf.empty () || buf.total () * buf.elemSize () < bytes)
+        buf.create (1, (int)bytes, CV_8UC1);
+    return Mat (size, type, buf.data);
+}
+
+void candidate_table_t::clear (void)
+{
+    points.clear ();
+    start.clear ();
+    count.clear ();
+    area.clear ();
+    cx.clear ();
+    cy.clear ();
+    vweight.clear ();
+    hweight.clear ();
+    x0.clear ();
+    y0.clear ();
+    x1.clear ();
+    y1.clear ();
+    darkness.clear ();
+}
+
+void candidate_table_t::copy_row (const candidate_table_t &from, int i)
+{
+    start.push_back (points.size ());
+    count.push_back (from.count[i]);
+    points.insert (points.end (), from.points.begin () + from.start[i], 
+                   from.points.begin () + from.start[i] + from.count[i]);
+    area.push_back (from.area[i]);
+    cx.push_back (from.cx[i]);
+    cy.push_back (from.cy[i]);
+    vweight.push_back (from.vweight[i]);
+    hweight.push_back (from.hweight[i]);
+    x0.push_back (from.x0[i]);
+    y0.push_back (from.y0[i]);
+    x1.push_back (from.x1[i]);
+    y1.push_back (from.y1[i]);
+    darkness.push_back (from.darkness[i]);
+}
+
+void candidate_table_t::swap (candidate_table_t &other)
+{
+    points.swap (other.points);
+    start.swap (other.start);
+    count.swap (other.count);
+    area.swap (other.area);
+    cx.swap (other.cx);
+    cy.swap (other.cy);
+    vweight.swap (other.vweight);
+    hweight.swap (other.hweight);
+    x0.swap (other.x0);
+    y0.swap (other.y0);
+    x1.swap (other.x1);
+    y1.swap (other.y1);
+    darkness.swap (other.darkness);
+}
+
+// Work out everything the filter and the classifier need to know about one
+// simplified contour in a single pass over its points, and add it to the 
+// table if it passes the filter. sum is the integral image of the part of
+// the frame starting at offset, and the area limits are in that frame's 
+// pixels.
+static void add_candidate (candidate_table_t &table, const Point *p, int n, const Mat &sum, Point offset, 
+                           double min_area, double max_area)
+{
+    // Shoelace sums for the area and center of mass, which are exact in 
+    // integers
+    int64 area2 = 0, cx6 = 0, cy6 = 0;
+    int min_x = p[0].x, min_y = p[0].y, max_x = p[0].x, max_y = p[0].y;
+    double vertweight = 0, horizweight = 0;
+    for (int i = 0; i < n; i++)
+    {
+        int j = i + 1 < n ? i + 1 : 0;
+        int64 cross = (int64)p[i].x * p[j].y - (int64)p[j].x * p[i].y;
+        area2 += cross;
+        cx6 += (p[i].x + p[j].x) * cross;
+        cy6 += (p[i].y + p[j].y) * cross;
         
-        // The contour detection algorithm generates contours around dark 
-        // patches, but also around light patches (i.e. spots of specular
-        // lighting or glare.) We're interested in the contours that enclose 
-        // darker regions, so filter by the average pixel intensity of the
-        // contour's bounding box. Method from
-        // http://stackoverflow.com/questions/17936510
-        Rect roi = boundingRect (tmp_contour);
-        if (mean (process_in (roi)).val[0] > 180)
-            continue;
+        min_x = min (min_x, p[i].x);
+        min_y = min (min_y, p[i].y);
+        max_x = max (max_x, p[i].x);
+        max_y = max (max_y, p[i].y);
         
-        contours.push_back (tmp_contour);
+        // The axis weights have never counted the segment closing the 
+        // outline, so that one gets a weight of zero
+        int dx = p[j].x - p[i].x, dy = p[j].y - p[i].y;
+        double weight = j ? sqrt ((double)(dx*dx + dy*dy)) : 0;
+        bool horiz = abs (dx) > abs (dy);
+        horizweight += horiz ? weight : 0;
+        vertweight += horiz ? 0 : weight;
     }
+    
+    // Filter out the contours in the wrong size range
+    double area = fabs ((double)area2) * 0.5;
+    if (area < min_area || area > max_area)
+        return;
+    
+    // The contour detection algorithm generates contours around dark 
+    // patches, but also around light patches (i.e. spots of specular
+    // lighting or glare.) We're interested in the contours that enclose 
+    // darker regions, so filter by the average pixel intensity of the
+    // contour's bounding box. Method from
+    // http://stackoverflow.com/questions/17936510
+    // The integral image makes that four lookups instead of a pass over the
+    // whole box.
+    int sx0 = min_x - offset.x, sy0 = min_y - offset.y;
+    int sx1 = max_x + 1 - offset.x, sy1 = max_y + 1 - offset.y;
+    double box_sum = (double)sum.at<int> (sy1, sx1) - sum.at<int> (sy0, sx1) 
+                   - sum.at<int> (sy1, sx0) + sum.at<int> (sy0, sx0);
+    float darkness = box_sum / ((sx1 - sx0) * (sy1 - sy0));
+    if (darkness > max_candidate_darkness)
+        return;
+    
+    table.start.push_back (table.points.size ());
+    table.count.push_back (n);
+    table.points.insert (table.points.end (), p, p + n);
+    table.area.push_back (area);
+    table.cx.push_back (cx6 / (3.0 * area2));
+    table.cy.push_back (cy6 / (3.0 * area2));
+    table.vweight.push_back (vertweight);
+    table.hweight.push_back (horizweight);
+    table.x0.push_back (min_x);
+    table.y0.push_back (min_y);
+    table.x1.push_back (max_x + 1);
+    table.y1.push_back (max_y + 1);
+    table.darkness.push_back (darkness);
+}
 
-    // Assign an arrow origin and direction to each contour
-    process_output.clear ();
-    for (int i = 0; i < contours.size (); i++)
+// Find contours and isolate the ones we're interested in. The candidates are
+// appended to the table, translated by offset (for when edges is just one
+// region of the frame.) As with detect_edges, scale says how big gray is 
+// compared to the full camera frame, and the size limits follow it.
+void find_candidates (Mat &edges, Point offset, const Mat &gray, candidate_table_t &candidates, double scale, 
+                      still_candidates_t *still)
+{
+    if (detect_config.components)
     {
-        // Determine the arrow's axis (vertical or horizontal)
-        double vertweight = 0, horizweight = 0;
-        for (int j = 0; j < contours[i].size() - 1; j++)
+        find_components (edges, offset, gray, candidates, scale);
+        return;
+    }
+    
+    // Kept from call to call (one set per thread), so that once they've 
+    // grown big enough nothing here allocates
+    static thread_local struct
+    {
+        outline_list_t outlines;
+        vector<Point> tmp_contour;
+        Mat sum_buffer;
+    } scratch;
+    outline_list_t &outlines = scratch.outlines;
+    trace_outlines (edges, offset, outlines);
+    
+    // Only the part of the frame edges covers is ever looked up, and only
+    // once some outline actually needs measuring
+    Mat sum = reuse_buffer (scratch.sum_buffer, edges.size () + Size (1, 1), CV_32S);
+    bool summed = false;
+    
+    TRACE_SCOPE ("filter_contours");
+    double min_area = min_candidate_area*scale_area*scale*scale, max_area = max_candidate_area*scale_area*scale*scale;
+    double epsilon = max (1.0, 2 * scale);
+    vector<Point> &tmp_contour = scratch.tmp_contour;
+    for (int i = 0; i < (int)outlines.start.size (); i++)
+    {
+        Point *points = &outlines.points[outlines.start[i]];
+        int count = outlines.count[i];
+        Rect outline;
+        int matched = -1;
+        if (still)
         {
-            Point2f diff = contours[i][j+1] - contours[i][j];
-            double weight = norm(diff);
-            if (fabs (diff.x) > fabs (diff.y))
-                horizweight += weight;
-            else
-                vertweight += weight;
+            outline = boundingRect (Mat (count, 1, CV_32SC2, points));
+            matched = still->match (outline);
+            if (matched >= 0 && still->settled (matched))
+            {
+                candidates.copy_row (still->last (), matched);
+                still->remember (candidates, candidates.size () - 1, outline, matched);
+                continue;
+            }
+        }
+        if (!summed)
+        {
+            TRACE_SCOPE ("integral");
+            integral (gray (Rect (offset, edges.size ())), sum, CV_32S);
+            summed = true;
         }
         
-        bool vert;
-        if (vertweight > 1.0*horizweight)
-            vert = true;
-        else if (horizweight > 1.0*vertweight)
-            vert = false;
-        else
-            continue;
-        
-        // Get center of mass
-        Moments mu = moments (contours[i], false);
-        Point2f mc = Point2f( mu.m10/mu.m00 , mu.m01/mu.m00 );
-        
-        // Get center of bounding box
-        Rect br = boundingRect( Mat(contours[i]) );
-        Point2f bc = (br.tl () + br.br ()) * 0.5;
-        
-        // determine the arrow's direction (left/right, up/down)
-        bool dir = (vert && mc.y > bc.y) || (!vert && mc.x > bc.x);
-        
-        arrow_t new_arrow;
-        new_arrow.contour_num = i;
-        new_arrow.dir = vert?(dir?arrow_down:arrow_up):(dir?arrow_right:arrow_left);
-        new_arrow.origin[0] = mc.x;
-        new_arrow.origin[1] = mc.y;
-        new_arrow.vert_min = br.tl ().y;
-        new_arrow.vert_max = br.br ().y;
-        process_output.push_back (new_arrow);
+        // Simplify the contour for efficiency
+        simplify_outline (points, count, epsilon, tmp_contour);
+        int before = candidates.size ();
+        if (!tmp_contour.empty ())
+            add_candidate (candidates, &tmp_contour[0], tmp_contour.size (), sum, offset, min_area, max_area);
+        if (still && candidates.size () > before)
+            still->remember (candidates, before, outline, matched);
     }
+    if (still)
+        still->next_frame ();
+}
+
+void detect_contours (Mat &edges, const Mat &gray, candidate_table_t &candidates, still_candidates_t *still)
+{
+    candidates.clear ();
+    find_candidates (edges, Point (0, 0), gray, candidates, 1, still);
+}
+
+// Work out the origin and direction of the arrow candidate i is drawn as.
+// Returns false if it can't tell which axis the arrow is on.
+bool classify_candidate (const candidate_table_t &candidates, int i, arrow_t &arrow)
+{
+    // Determine the arrow's axis (vertical or horizontal)
+    double vertweight = candidates.vweight[i], horizweight = candidates.hweight[i];
+    bool vert;
+    if (vertweight > 1.0*horizweight)
+        vert = true;
+    else if (horizweight > 1.0*vertweight)
+        vert = false;
+    else
+        return false;
+    
+    // Get center of mass
+    Point2f mc (candidates.cx[i], candidates.cy[i]);
+    
+    // Get center of bounding box (rounded to whole pixels, as it always
+    // has been)
+    Point2f bc (cvRound ((candidates.x0[i] + candidates.x1[i]) * 0.5), 
+                cvRound ((candidates.y0[i] + candidates.y1[i]) * 0.5));
     
-    // Organize arrows into rows and columns
-    sort (process_output.begin (), process_output.end (), compare_arrow);
+    // determine the arrow's direction (left/right, up/down)
+    bool dir = (vert && mc.y > bc.y) || (!vert && mc.x > bc.x);
     
-    // Rescale contours down to fit drawing area
-    for (auto i = contours.begin (); i != contours.end (); i++)
+    arrow.contour_num = i;
+    arrow.track_id = -1;
+    arrow.dir = vert?(dir?arrow_down:arrow_up):(dir?arrow_right:arrow_left);
+    arrow.origin[0] = mc.x;
+    arrow.origin[1] = mc.y;
+    arrow.vert_min = candidates.y0[i];
+    arrow.vert_max = candidates.y1[i];
+    return true;
+}
+
+// Assign an arrow origin and direction to each candidate
+void classify_candidates (const candidate_table_t &candidates, arrowvec_t &process_output)
+{
+    TRACE_SCOPE ("classify");
+    process_output.clear ();
+    arrow_t new_arrow;
+    for (int i = 0; i < candidates.size (); i++)
     {
-        for (auto j = i->begin (); j != i->end (); j++)
-            *j *= 0.5;
+        if (classify_candidate (candidates, i, new_arrow))
+            process_output.push_back (new_arrow);
     }
-    
-    // Draw a visualization of what the image processing algorithm sees
-    Mat drawing = processing_visualization_area;
+    sort_arrows (process_output);
+}
+
+// Draw a visualization of what the image processing algorithm sees. The 
+// drawing is half the size of the frame.
+void draw_visualization (const candidate_table_t &candidates, const arrowvec_t &process_output, Mat &drawing)
+{
+    TRACE_SCOPE ("visualization");
+    double arrow_scale = 10*scale_len;
     drawing.setTo (Scalar (0, 0, 0));
     Point2f cursor (arrow_scale, arrow_scale);
     int n = 0;
@@ -179,8 +373,11 @@ void do_process (Mat process_in)
         // Draw a dot at the center of the arrow
         circle (drawing, org, 4, color, -1, 8, 0);
         
-        // Draw an outline of the drawn object
-        drawContours (drawing, contours, i->contour_num, color, 1, 8, hierarchy, 0, Point());
+        // Draw an outline of the drawn object. One bit of fixed-point shift
+        // scales it down to fit the drawing.
+        const Point *outline = &candidates.points[candidates.start[i->contour_num]];
+        int outline_len = candidates.count[i->contour_num];
+        polylines (drawing, &outline, &outline_len, 1, true, color, 1, 8, 1);
         
         // Draw what type of arrow we think the drawn object is over the drawn
         // object itself
@@ -200,6 +397,41 @@ void do_process (Mat process_in)
             cursor.x = arrow_scale;
         }
     }
+}
 
-    process_done = true;
+/** @function do_process */
+void do_process (const Mat &process_in, arrowvec_t &process_output, detect_state_t *state)
+{
+    // With a state, the buffers are reused from last time
+    detect_state_t local;
+    detect_state_t &buffers = state ? *state : local;
+    Mat &canny_out = buffers.edges;
+    candidate_table_t &candidates = buffers.candidates;
+    
+    if (state && detect_config.incremental)
+    {
+        frame_changes_t &changes = buffers.changes;
+        detect_changed_edges (process_in, *state, changes, canny_out);
+        detect_changed_contours (canny_out, process_in, changes, *state, candidates);
+    }
+    else if (detect_config.pyramid_levels > 0)
+    {
+        Mat &small = buffers.small;
+        detect_coarse_edges (process_in, detect_config.pyramid_levels, small, canny_out);
+        detect_refined_contours (canny_out, small, process_in, detect_config.pyramid_levels, candidates);
+    }
+    else if (buffers.scale < 1)
+    {
+        detect_scaled_edges (process_in, buffers.scale, buffers.small, canny_out);
+        detect_scaled_contours (canny_out, buffers.small, buffers.scale, candidates);
+    }
+    else
+    {
+        detect_edges (process_in, canny_out);
+        detect_contours (canny_out, process_in, candidates, state && detect_config.track ? &state->still : NULL);
+    }
+    if (state && detect_config.track)
+        state->tracker.update (candidates, process_output);
+    else
+        classify_candidates (candidates, process_output);
 }
@@ -0,0 +1,180 @@
+/*
+Mazedemo, by Max Eliaser
+
+Copyright (c) 2014 Intel Corp.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Coarse-to-fine detection. Arrows are big blobs, and they survive the 
+// frame being shrunk just fine, so the expensive part of detection (Canny,
+// dilate and findContours over every pixel) can run on a copy a half or a
+// quarter of the size. That only says roughly where the arrows are; at that
+// size the outline is too blocky to trust for the direction. So each 
+// candidate is then detected again at full size, in a window just around
+// it, which finds the same contour the single-scale path would have.
+
+#include "opencv2/imgproc/imgproc.hpp"
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include "mazedemo_common.h"
+#include "trace.h"
+
+using namespace cv;
+using namespace std;
+
+// Room left around each coarse candidate, in full-size pixels. A coarse 
+// pixel covers 2^levels full ones, and the dilation reaches a bit further
+// at the coarse size than at full size.
+static int window_margin (int levels)
+{
+    return (4 << levels) + 8;
+}
+
+// If a window turns out to cut an arrow off, it's grown to fit and tried 
+// again, up to this many times
+const int max_window_attempts = 3;
+
+static Rect grow (const Rect &r, int margin)
+{
+    return Rect (r.x - margin, r.y - margin, r.width + 2 * margin, r.height + 2 * margin);
+}
+
+// findContours can't see past the edge of the window, so a contour running
+// into it (other than at the edge of the frame) has been cut off
+static bool cut_off (const Rect &bbox, const Rect &window, const Size &frame_size)
+{
+    return (bbox.x <= window.x + 1 && window.x > 0) ||
+           (bbox.y <= window.y + 1 && window.y > 0) ||
+           (bbox.br ().x >= window.br ().x - 1 && window.br ().x < frame_size.width) ||
+           (bbox.br ().y >= window.br ().y - 1 && window.br ().y < frame_size.height);
+}
+
+// Working space, kept from frame to frame (one set per thread) so it's only
+// allocated while warming up
+typedef struct
+{
+    Mat levels[2]; // the in-between pyramid levels
+    candidate_table_t coarse, found;
+    vector<Rect> windows;
+    Mat window_edges;
+} pyramid_scratch_t;
+
+static thread_local pyramid_scratch_t scratch;
+
+void detect_coarse_edges (const Mat &gray, int levels, Mat &small, Mat &edges)
+{
+    {
+        TRACE_SCOPE ("pyrDown");
+        // Only the last level goes into small, which belongs to the frame
+        Mat level = gray;
+        for (int l = 0; l < levels; l++)
+        {
+            Mat &next = l == levels - 1 ? small : scratch.levels[l & 1];
+            pyrDown (level, next);
+            level = next;
+        }
+        if (levels == 0)
+            small = gray;
+    }
+    detect_edges (small, edges, 1.0 / (1 << levels));
+}
+
+void detect_refined_contours (Mat &edges, const Mat &small, const Mat &gray, int levels, candidate_table_t &candidates)
+{
+    candidate_table_t &coarse = scratch.coarse;
+    coarse.clear ();
+    find_candidates (edges, Point (0, 0), small, coarse, 1.0 / (1 << levels));
+    
+    TRACE_SCOPE ("refine");
+    Rect frame_rect (Point (0, 0), gray.size ());
+    int margin = window_margin (levels);
+    vector<Rect> &windows = scratch.windows;
+    windows.clear ();
+    for (int i = 0; i < coarse.size (); i++)
+    {
+        Rect bbox (coarse.x0[i] << levels, coarse.y0[i] << levels,
+                   (coarse.x1[i] - coarse.x0[i]) << levels, (coarse.y1[i] - coarse.y0[i]) << levels);
+        windows.push_back (grow (bbox, margin) & frame_rect);
+    }
+    
+    // Arrows close together share one window, so nothing is found twice
+    for (bool merged = true; merged; )
+    {
+        merged = false;
+        for (size_t i = 0; i < windows.size () && !merged; i++)
+        {
+            for (size_t j = i + 1; j < windows.size () && !merged; j++)
+            {
+                if ((windows[i] & windows[j]).area () > 0)
+                {
+                    windows[i] |= windows[j];
+                    windows.erase (windows.begin () + j);
+                    merged = true;
+                }
+            }
+        }
+    }
+    
+    candidates.clear ();
+    candidate_table_t &found = scratch.found;
+    for (size_t w = 0; w < windows.size (); w++)
+    {
+        Rect window = windows[w];
+        int window_first = candidates.size ();
+        for (int attempt = 1; ; attempt++)
+        {
+            // detect_edges rather than reusing anything from the coarse 
+            // pass, since the thresholds are only right at full size
+            Mat window_edges = reuse_buffer (scratch.window_edges, window.size (), CV_8UC1);
+            detect_edges (gray (window), window_edges);
+            found.clear ();
+            find_candidates (window_edges, window.tl (), gray, found);
+            
+            Rect grown = window;
+            for (int i = 0; i < found.size (); i++)
+            {
+                if (cut_off (found.bbox (i), window, gray.size ()))
+                    grown |= grow (found.bbox (i), margin) & frame_rect;
+            }
+            if (grown == window || attempt == max_window_attempts)
+                break;
+            window = grown;
+        }
+        
+        for (int i = 0; i < found.size (); i++)
+        {
+            Rect bbox = found.bbox (i);
+            if (cut_off (bbox, window, gray.size ()))
+                continue;
+            
+            // A window that was grown can overlap another one, and then
+            // both find the same arrow
+            bool seen = false;
+            for (int j = 0; j < window_first && !seen; j++)
+            {
+                Rect other = candidates.bbox (j);
+                seen = 2 * (other & bbox).area () > min (other.area (), bbox.area ());
+            }
+            if (!seen)
+                candidates.copy_row (found, i);
+        }
+    }
+}
@@ -0,0 +1,157 @@
+/*
+Mazedemo, by Max Eliaser
+
+Copyright (c) 2014 Intel Corp.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Edge detection split into horizontal stripes across a thread pool, with 
+// the same result as running it on the whole frame in one go.
+//
+// Canny comes apart into two parts. Which pixels are candidates (a local 
+// maximum of the gradient above the low threshold) and which of those are 
+// strong (above the high one) depends only on the pixels nearby, so each 
+// stripe works both out for its own rows in one pass over the gradient 
+// (canny_classify, img_edges.cpp). Hysteresis then keeps the candidates 
+// connected to a strong one, for as far as they go, across any stripe 
+// boundary. Each stripe follows them as far as it can without leaving its 
+// rows and dilates what it found into the same rows while they're still in
+// cache, all in one run of the pool.
+//
+// That leaves two things for one short serial pass at the end. Anything 
+// hysteresis missed has to be reachable through a boundary, so following 
+// on from the edges either side of each boundary finds it; that's usually 
+// only a handful of pixels. And the dilated rows within reach of a boundary
+// (or of anything found there) are missing whatever was on the other side,
+// so those few rows are dilated again from the finished edges.
+
+#include "opencv2/imgproc/imgproc.hpp"
+#include "mazedemo_common.h"
+#include "work_pool.h"
+#include "trace.h"
+
+using namespace cv;
+using namespace std;
+
+// Narrower stripes than this aren't worth the overhead
+const int min_stripe_rows = 32;
+
+// Per stripe rather than per worker, since stealing means a stripe can go
+// to any of them; there's never more stripes than workers, so it comes to
+// the same number of buffers
+typedef struct
+{
+    vector<int> stack;
+} stripe_scratch_t;
+
+// The frame-sized edge map the stripes fill in, and the pool that runs 
+// them. Being thread_local, the pool lasts as long as the thread doing edge
+// detection (the edge stage's, in the staged pipeline), and its threads 
+// wait for the next frame rather than being started for each one.
+static thread_local struct
+{
+    Mat map;
+    vector<int> stack, found;
+    vector<char> redo;
+    vector<stripe_scratch_t> stripes;
+    work_pool_t pool;
+} frame_scratch;
+
+// One stripe: rows y0 to y1 of map get every edge that can be reached from
+// a strong pixel without leaving them, and the same rows of edges get 
+// those dilated
+static void edge_stripe (const Mat &gray, int y0, int y1, const Mat &element, stripe_scratch_t &scratch, Mat &map, Mat &edges)
+{
+    TRACE_SCOPE ("edge_stripe");
+    canny_classify (gray, y0, y1, map);
+    canny_seed (map, y0, y1, scratch.stack);
+    canny_follow (map, scratch.stack, y0, y1);
+    dilate_edges (map, edges, element, y0, y1, y0, y1);
+}
+
+bool detect_striped_edges (const Mat &gray, Mat &edges, const Mat &element, int num_threads)
+{
+    int num_stripes = min (num_threads, gray.rows / min_stripe_rows);
+    Mat map = reuse_buffer (frame_scratch.map, gray.size (), CV_8UC1);
+    // With no rows to do, dilate_edges just checks it can use element
+    if (num_stripes < 2 || !dilate_edges (map, map, element, 0, 0, 0, 0))
+        return false;
+    
+    edges.create (gray.size (), CV_8UC1);
+    vector<stripe_scratch_t> &stripes = frame_scratch.stripes;
+    if ((int)stripes.size () < num_stripes)
+        stripes.resize (num_stripes);
+    auto stripe_start = [&] (int stripe) {return gray.rows * stripe / num_stripes;};
+    
+    {
+        TRACE_SCOPE ("edge_stripes");
+        frame_scratch.pool.run (num_stripes, num_threads, [&] (int stripe, int worker)
+        {
+            edge_stripe (gray, stripe_start (stripe), stripe_start (stripe + 1), element, stripes[stripe], map, edges);
+        });
+    }
+    
+    TRACE_SCOPE ("stripe_boundaries");
+    // Whatever the stripes couldn't reach on their own, starting from the
+    // edges either side of each boundary
+    vector<int> &stack = frame_scratch.stack, &found = frame_scratch.found;
+    found.clear ();
+    for (int stripe = 1; stripe < num_stripes; stripe++)
+    {
+        int boundary = stripe_start (stripe);
+        for (int y = boundary - 1; y <= boundary; y++)
+        {
+            const uchar *m = map.ptr<uchar> (y);
+            for (int x = 0; x < gray.cols; x++)
+            {
+                if (m[x] == 255)
+                    stack.push_back (y * gray.cols + x);
+            }
+        }
+    }
+    canny_follow (map, stack, 0, gray.rows, &found);
+    
+    // Dilating row y looks at rows y - above to y + below
+    int above = element.rows / 2, below = element.rows - 1 - above;
+    vector<char> &redo = frame_scratch.redo;
+    redo.assign (gray.rows, 0);
+    auto reach = [&] (int y0, int y1)
+    {
+        fill (redo.begin () + max (0, y0), redo.begin () + min (gray.rows, y1), 1);
+    };
+    for (int stripe = 1; stripe < num_stripes; stripe++)
+        reach (stripe_start (stripe) - below, stripe_start (stripe) + above);
+    for (auto p = found.begin (); p != found.end (); p++)
+        reach (*p / gray.cols - below, *p / gray.cols + above + 1);
+    for (int y = 0; y < gray.rows; )
+    {
+        if (!redo[y])
+        {
+            y++;
+            continue;
+        }
+        int end = y;
+        while (end < gray.rows && redo[end])
+            end++;
+        dilate_edges (map, edges, element, y, end, 0, gray.rows);
+        y = end;
+    }
+    return true;
+}
@@ -0,0 +1,220 @@
+/*
+Mazedemo, by Max Eliaser
+
+Copyright (c) 2014 Intel Corp.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Frame-to-frame arrow tracking. Arrows on a worksheet mostly stay exactly
+// where they were drawn, so once one has been seen in the same place for a
+// few frames there's nothing to gain from working out its direction again,
+// and only new arrows (or ones that moved) get the full treatment. The 
+// contour stage does the same for its part, so a settled arrow's outline 
+// isn't simplified or measured either.
+
+#include "opencv2/imgproc/imgproc.hpp"
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include "mazedemo_common.h"
+#include "trace.h"
+
+using namespace cv;
+using namespace std;
+
+// A candidate belongs to a track if their bounding boxes overlap by at 
+// least this much (intersection over union)
+const double min_overlap = 0.5;
+
+// A bounding box whose edges all stay within this many pixels hasn't moved
+const int still_tolerance = 2;
+
+// Frames an arrow has to sit still before it stops being reclassified
+const int confirm_frames = 3;
+
+// Frames a new direction has to hold before an arrow's direction changes
+const int switch_frames = 2;
+
+// Frames a track survives without being seen, for when a hand passes over
+// an arrow
+const int max_missed_frames = 5;
+
+// How much of each new position goes into the smoothed origin
+const double origin_smoothing = 0.5;
+
+static double overlap (const Rect &a, const Rect &b)
+{
+    double intersection = (a & b).area ();
+    return intersection / (a.area () + b.area () - intersection);
+}
+
+static bool still (const Rect &a, const Rect &b)
+{
+    return abs (a.x - b.x) <= still_tolerance && abs (a.y - b.y) <= still_tolerance &&
+           abs (a.br ().x - b.br ().x) <= still_tolerance && abs (a.br ().y - b.br ().y) <= still_tolerance;
+}
+
+void arrow_tracker_t::reset (void)
+{
+    tracks.clear ();
+}
+
+void arrow_tracker_t::update (const candidate_table_t &candidates, arrowvec_t &arrows)
+{
+    TRACE_SCOPE ("track");
+    arrows.clear ();
+    for (auto t = tracks.begin (); t != tracks.end (); t++)
+        t->matched = false;
+    
+    arrow_t arrow;
+    for (int i = 0; i < candidates.size (); i++)
+    {
+        Rect bbox = candidates.bbox (i);
+        
+        track_t *best = NULL;
+        double best_overlap = min_overlap;
+        for (auto t = tracks.begin (); t != tracks.end (); t++)
+        {
+            double o;
+            if (!t->matched && (o = overlap (t->bbox, bbox)) >= best_overlap)
+            {
+                best = &*t;
+                best_overlap = o;
+            }
+        }
+        
+        if (!best)
+        {
+            // Something new
+            if (!classify_candidate (candidates, i, arrow))
+                continue;
+            track_t track;
+            track.id = next_id++;
+            track.bbox = bbox;
+            track.origin[0] = arrow.origin[0];
+            track.origin[1] = arrow.origin[1];
+            track.dir = track.pending_dir = arrow.dir;
+            track.pending_frames = track.still_frames = track.missed_frames = 0;
+            track.matched = true;
+            tracks.push_back (track);
+            arrow.track_id = track.id;
+            arrows.push_back (arrow);
+            continue;
+        }
+        
+        track_t &track = *best;
+        track.matched = true;
+        track.missed_frames = 0;
+        bool is_still = still (track.bbox, bbox);
+        track.still_frames = is_still ? track.still_frames + 1 : 0;
+        track.bbox = bbox;
+        
+        if (track.still_frames < confirm_frames)
+        {
+            if (classify_candidate (candidates, i, arrow))
+            {
+                track.origin[0] += origin_smoothing * (arrow.origin[0] - track.origin[0]);
+                track.origin[1] += origin_smoothing * (arrow.origin[1] - track.origin[1]);
+                
+                if (arrow.dir == track.dir)
+                    track.pending_frames = 0;
+                else if (arrow.dir == track.pending_dir && track.pending_frames > 0)
+                    track.pending_frames++;
+                else
+                {
+                    track.pending_dir = arrow.dir;
+                    track.pending_frames = 1;
+                }
+                if (track.pending_frames >= switch_frames)
+                {
+                    track.dir = track.pending_dir;
+                    track.pending_frames = 0;
+                }
+            }
+            // If it couldn't be classified this time, go with what it was
+            // last time
+        }
+        
+        arrow.contour_num = i;
+        arrow.track_id = track.id;
+        arrow.dir = track.dir;
+        arrow.origin[0] = track.origin[0];
+        arrow.origin[1] = track.origin[1];
+        arrow.vert_min = bbox.y;
+        arrow.vert_max = bbox.br ().y;
+        arrows.push_back (arrow);
+    }
+    
+    for (size_t t = 0; t < tracks.size (); )
+    {
+        if (!tracks[t].matched && ++tracks[t].missed_frames > max_missed_frames)
+            tracks.erase (tracks.begin () + t);
+        else
+            t++;
+    }
+    
+    sort_arrows (arrows);
+}
+
+int still_candidates_t::match (const Rect &outline) const
+{
+    for (size_t i = 0; i < last_outlines.size (); i++)
+    {
+        if (still (last_outlines[i], outline))
+            return i;
+    }
+    return -1;
+}
+
+bool still_candidates_t::settled (int row) const
+{
+    return last_still[row] >= confirm_frames;
+}
+
+void still_candidates_t::remember (const candidate_table_t &candidates, int i, const Rect &outline, int matched)
+{
+    next_table.copy_row (candidates, i);
+    if (matched >= 0 && settled (matched))
+    {
+        // Still measured against where it settled, so a slow drift adds up
+        // to a move eventually
+        next_outlines.push_back (last_outlines[matched]);
+    }
+    else
+        next_outlines.push_back (outline);
+    next_still.push_back (matched >= 0 ? last_still[matched] + 1 : 0);
+}
+
+void still_candidates_t::next_frame (void)
+{
+    last_table.swap (next_table);
+    last_outlines.swap (next_outlines);
+    last_still.swap (next_still);
+    next_table.clear ();
+    next_outlines.clear ();
+    next_still.clear ();
+}
+
+void still_candidates_t::reset (void)
+{
+    last_table.clear ();
+    last_outlines.clear ();
+    last_still.clear ();
+}
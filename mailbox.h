@@ -0,0 +1,86 @@
+/*
+Mazedemo, by Max Eliaser
+
+Copyright (c) 2014 Intel Corp.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Lock-free single-producer/single-consumer hand-off where the newest value
+// always wins, a.k.a. a triple buffer. The producer always owns one slot to 
+// fill and the consumer always owns one slot to read; the third slot is the 
+// one in flight between them. Neither side ever blocks or waits on the 
+// other. If the producer publishes twice before the consumer looks, the 
+// older value is silently replaced, which is exactly what we want for video
+// frames: there's no point in detecting arrows on a stale frame.
+//
+// Slots are reused rather than reallocated, so a cv::Mat or std::vector in
+// T keeps its buffer across hand-offs.
+
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <atomic>
+
+template <typename T>
+class mailbox_t
+{
+    static const int fresh_bit = 4; // set in middle while it holds unread data
+    
+    T slots[3];
+    int back, front; // owned by the producer and consumer respectively
+    std::atomic<int> middle;
+    
+public:
+    mailbox_t (void) : back (0), front (1), middle (2) {}
+    
+    // Producer side: fill in write_slot (), then publish () it.
+    T &write_slot (void) {return slots[back];}
+    void publish (void)
+    {
+        back = middle.exchange (back | fresh_bit, std::memory_order_acq_rel) & ~fresh_bit;
+    }
+    
+    // Consumer side: if fetch () returns true, read_slot () now holds the 
+    // newest published value. Otherwise read_slot () is unchanged.
+    bool fetch (void)
+    {
+        if (!pending ())
+            return false;
+        front = middle.exchange (front, std::memory_order_acq_rel) & ~fresh_bit;
+        return true;
+    }
+    T &read_slot (void) {return slots[front];}
+    
+    bool pending (void) const
+    {
+        return (middle.load (std::memory_order_acquire) & fresh_bit) != 0;
+    }
+    
+    // Only once neither side is running any more: let go of whatever the 
+    // slots are holding on to
+    void clear (void)
+    {
+        for (int i = 0; i < 3; i++)
+            slots[i] = T ();
+        middle.fetch_and (~fresh_bit);
+    }
+};
+
+#endif
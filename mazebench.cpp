@@ -0,0 +1,681 @@
+/*
+Mazedemo, by Max Eliaser
+
+Copyright (c) 2014 Intel Corp.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Benchmarks the detection and maze hot paths in isolation, so performance
+// regressions show up before a build goes out to the floor. Detection runs
+// over a directory of recorded frames (bench_corpus by default), the maze
+// code over generated mazes of increasing size. Every result is printed as
+// one JSON object per line.
+
+#include "opencv2/highgui/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+#include <iostream>
+#include <algorithm>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mazedemo_common.h"
+
+using namespace cv;
+using namespace std;
+
+static double ms_since (timestamp_t t)
+{
+    return chrono::duration<double, milli> (chrono::steady_clock::now () - t).count ();
+}
+
+static double percentile (const vector<double> &sorted, double p)
+{
+    if (sorted.empty ())
+        return 0;
+    size_t idx = min (sorted.size () - 1, (size_t)(p * sorted.size ()));
+    return sorted[idx];
+}
+
+// params is a fragment of JSON identifying what was measured
+static double median (vector<double> samples)
+{
+    sort (samples.begin (), samples.end ());
+    return percentile (samples, 0.5);
+}
+
+static void report (const char *bench, const string &params, vector<double> samples, double allocs_per_call)
+{
+    double total = 0;
+    for (size_t i = 0; i < samples.size (); i++)
+        total += samples[i];
+    sort (samples.begin (), samples.end ());
+    
+    printf ("{\"bench\": \"%s\", %s, \"samples\": %d, \"p50_ms\": %.4f, \"p95_ms\": %.4f, \"p99_ms\": %.4f, "
+            "\"per_sec\": %.2f, \"allocs_per_call\": %.2f}\n",
+            bench, params.c_str (), (int)samples.size (), percentile (samples, 0.5), 
+            percentile (samples, 0.95), percentile (samples, 0.99), 
+            total > 0 ? 1000.0 * samples.size () / total : 0.0, allocs_per_call);
+    fflush (stdout);
+}
+
+// How many of arrows are also in reference: same direction, origin within
+// tolerance pixels
+static int count_matches (const arrowvec_t &arrows, const arrowvec_t &reference, double tolerance)
+{
+    int found = 0;
+    for (size_t i = 0; i < arrows.size (); i++)
+    {
+        for (size_t j = 0; j < reference.size (); j++)
+        {
+            if (arrows[i].dir == reference[j].dir &&
+                fabs (arrows[i].origin[0] - reference[j].origin[0]) < tolerance &&
+                fabs (arrows[i].origin[1] - reference[j].origin[1]) < tolerance)
+            {
+                found++;
+                break;
+            }
+        }
+    }
+    return found;
+}
+
+static bool bench_detect (const char *corpus, int iterations)
+{
+    frame_source_t *source = open_frame_source ((string ("dir:") + corpus).c_str ());
+    if (!source)
+        return false;
+    
+    vector<Mat> frames;
+    Mat src;
+    while (source->getframe (src))
+    {
+        frames.push_back (Mat ());
+        cvtColor (src, frames.back (), CV_BGR2GRAY);
+    }
+    delete source;
+    
+    const char *stage_names[] = {"edges", "contours", "classify", "visualization", "total"};
+    const int num_stages = sizeof(stage_names)/sizeof(*stage_names);
+    vector<double> samples[num_stages];
+    unsigned long allocs[num_stages] = {0};
+    int num_arrows = 0;
+    
+    Mat edges, visualization (cfg_h/2, cfg_w/2, CV_8UC3);
+    candidate_table_t candidates;
+    arrowvec_t arrows;
+    
+    // One untimed pass to warm up caches and OpenCV's internal buffers. 
+    // What it finds is also what the other modes get compared against.
+    vector<arrowvec_t> reference (frames.size ());
+    for (size_t f = 0; f < frames.size (); f++)
+        do_process (frames[f], reference[f]);
+    
+    for (int it = 0; it < iterations; it++)
+    {
+        for (size_t f = 0; f < frames.size (); f++)
+        {
+            timestamp_t start = chrono::steady_clock::now (), t;
+            unsigned long frame_allocs = alloc_count (), a;
+            
+            #define TIME_STAGE(num, call) \
+                t = chrono::steady_clock::now (); \
+                a = alloc_count (); \
+                call; \
+                samples[num].push_back (ms_since (t)); \
+                allocs[num] += alloc_count () - a;
+            
+            TIME_STAGE (0, detect_edges (frames[f], edges))
+            TIME_STAGE (1, detect_contours (edges, frames[f], candidates))
+            TIME_STAGE (2, classify_candidates (candidates, arrows))
+            TIME_STAGE (3, draw_visualization (candidates, arrows, visualization))
+            
+            samples[4].push_back (ms_since (start));
+            allocs[4] += alloc_count () - frame_allocs;
+            num_arrows += arrows.size ();
+        }
+    }
+    
+    // Incremental re-detection, with every frame held for a few iterations
+    // the way a worksheet sits still in front of the camera
+    const int hold = 5;
+    vector<double> incremental_samples;
+    unsigned long incremental_allocs = 0;
+    detect_state_t state;
+    detect_config.incremental = true;
+    for (int it = 0; it < iterations; it++)
+    {
+        for (size_t f = 0; f < frames.size (); f++)
+        {
+            for (int h = 0; h < hold; h++)
+            {
+                timestamp_t start = chrono::steady_clock::now ();
+                unsigned long a = alloc_count ();
+                do_process (frames[f], arrows, &state);
+                incremental_samples.push_back (ms_since (start));
+                incremental_allocs += alloc_count () - a;
+            }
+        }
+    }
+    detect_config.incremental = false;
+    
+    // Coarse-to-fine detection at each pyramid level, and how many of the 
+    // single-scale path's arrows it still finds
+    const int max_levels = 2;
+    vector<double> pyramid_samples[max_levels + 1];
+    unsigned long pyramid_allocs[max_levels + 1] = {0};
+    int matched[max_levels + 1] = {0}, extra[max_levels + 1] = {0};
+    for (int levels = 1; levels <= max_levels; levels++)
+    {
+        detect_config.pyramid_levels = levels;
+        for (int it = 0; it < iterations; it++)
+        {
+            for (size_t f = 0; f < frames.size (); f++)
+            {
+                timestamp_t start = chrono::steady_clock::now ();
+                unsigned long a = alloc_count ();
+                do_process (frames[f], arrows);
+                pyramid_samples[levels].push_back (ms_since (start));
+                pyramid_allocs[levels] += alloc_count () - a;
+                
+                if (it == 0)
+                {
+                    int found = count_matches (arrows, reference[f], 2);
+                    matched[levels] += found;
+                    extra[levels] += arrows.size () - found;
+                }
+            }
+        }
+    }
+    detect_config.pyramid_levels = 0;
+    
+    // Each of the sizes the latency governor can step down to. An origin 
+    // is only good to about a pixel at the size it was found at.
+    const double scales[] = {0.75, 0.5, 0.375, 0.25};
+    const int num_scales = sizeof(scales)/sizeof(*scales);
+    vector<double> scaled_samples[num_scales];
+    unsigned long scaled_allocs[num_scales] = {0};
+    int scaled_matched[num_scales] = {0}, scaled_extra[num_scales] = {0};
+    for (int s = 0; s < num_scales; s++)
+    {
+        state.scale = scales[s];
+        for (int it = 0; it < iterations; it++)
+        {
+            for (size_t f = 0; f < frames.size (); f++)
+            {
+                timestamp_t start = chrono::steady_clock::now ();
+                unsigned long a = alloc_count ();
+                do_process (frames[f], arrows, &state);
+                scaled_samples[s].push_back (ms_since (start));
+                scaled_allocs[s] += alloc_count () - a;
+                
+                if (it == 0)
+                {
+                    int found = count_matches (arrows, reference[f], 2 / scales[s]);
+                    scaled_matched[s] += found;
+                    scaled_extra[s] += arrows.size () - found;
+                }
+            }
+        }
+    }
+    state.scale = 1;
+    
+    // Connected components in place of findContours and approxPolyDP, timed
+    // on their own so they can be set against the contours row. Pixel 
+    // centroids and outline centroids differ by a pixel or so.
+    vector<double> component_samples;
+    unsigned long component_allocs = 0;
+    int component_matched = 0, component_extra = 0;
+    detect_config.components = true;
+    for (int it = 0; it < iterations; it++)
+    {
+        for (size_t f = 0; f < frames.size (); f++)
+        {
+            detect_edges (frames[f], edges);
+            timestamp_t start = chrono::steady_clock::now ();
+            unsigned long a = alloc_count ();
+            detect_contours (edges, frames[f], candidates);
+            component_samples.push_back (ms_since (start));
+            component_allocs += alloc_count () - a;
+            
+            if (it == 0)
+            {
+                classify_candidates (candidates, arrows);
+                int found = count_matches (arrows, reference[f], 3);
+                component_matched += found;
+                component_extra += arrows.size () - found;
+            }
+        }
+    }
+    detect_config.components = false;
+    
+    // Striped edge detection at a few thread counts, each frame timed 
+    // against a serial run on the same frame right after, and checked pixel
+    // for pixel against it
+    const int stripe_threads[] = {2, 4, 8, 16};
+    const int num_stripe_threads = sizeof(stripe_threads)/sizeof(*stripe_threads);
+    vector<double> striped_samples[num_stripe_threads], striped_serial_samples[num_stripe_threads];
+    unsigned long striped_allocs[num_stripe_threads] = {0};
+    int striped_mismatched[num_stripe_threads] = {0};
+    Mat serial_edges, difference;
+    for (int s = 0; s < num_stripe_threads; s++)
+    {
+        for (int it = 0; it < iterations; it++)
+        {
+            for (size_t f = 0; f < frames.size (); f++)
+            {
+                detect_config.edge_threads = stripe_threads[s];
+                timestamp_t start = chrono::steady_clock::now ();
+                unsigned long a = alloc_count ();
+                detect_edges (frames[f], edges);
+                striped_samples[s].push_back (ms_since (start));
+                striped_allocs[s] += alloc_count () - a;
+                
+                detect_config.edge_threads = 0;
+                start = chrono::steady_clock::now ();
+                detect_edges (frames[f], serial_edges);
+                striped_serial_samples[s].push_back (ms_since (start));
+                
+                if (it == 0)
+                {
+                    bitwise_xor (edges, serial_edges, difference);
+                    striped_mismatched[s] += countNonZero (difference);
+                }
+            }
+        }
+    }
+    detect_config.edge_threads = 0;
+    
+    // The tracker in place of classify_candidates, with frames held like
+    // above so most arrows get to sit still
+    vector<double> tracked_samples;
+    unsigned long tracked_allocs = 0;
+    arrow_tracker_t tracker;
+    for (int it = 0; it < iterations; it++)
+    {
+        for (size_t f = 0; f < frames.size (); f++)
+        {
+            detect_edges (frames[f], edges);
+            detect_contours (edges, frames[f], candidates);
+            for (int h = 0; h < hold; h++)
+            {
+                timestamp_t start = chrono::steady_clock::now ();
+                unsigned long a = alloc_count ();
+                tracker.update (candidates, arrows);
+                tracked_samples.push_back (ms_since (start));
+                tracked_allocs += alloc_count () - a;
+            }
+        }
+    }
+    
+    // The contour stage with tracking on, frames held the same way, so 
+    // settled outlines get copied instead of measured; set it against the 
+    // contours row
+    vector<double> still_samples;
+    unsigned long still_allocs = 0;
+    still_candidates_t still;
+    for (int it = 0; it < iterations; it++)
+    {
+        for (size_t f = 0; f < frames.size (); f++)
+        {
+            for (int h = 0; h < hold; h++)
+            {
+                detect_edges (frames[f], edges);
+                timestamp_t start = chrono::steady_clock::now ();
+                unsigned long a = alloc_count ();
+                detect_contours (edges, frames[f], candidates, &still);
+                still_samples.push_back (ms_since (start));
+                still_allocs += alloc_count () - a;
+            }
+        }
+    }
+    
+    int n = iterations * frames.size ();
+    for (int i = 0; i < num_stages; i++)
+    {
+        char params[256];
+        snprintf (params, sizeof(params), "\"stage\": \"%s\", \"frames\": %d, \"arrows_per_frame\": %.2f", 
+                  stage_names[i], (int)frames.size (), n ? (double)num_arrows / n : 0.0);
+        report ("detect", params, samples[i], n ? (double)allocs[i] / n : 0.0);
+    }
+    char params[256];
+    snprintf (params, sizeof(params), "\"stage\": \"total_incremental\", \"frames\": %d, \"hold\": %d", 
+              (int)frames.size (), hold);
+    report ("detect", params, incremental_samples, n ? (double)incremental_allocs / (n * hold) : 0.0);
+    
+    snprintf (params, sizeof(params), "\"stage\": \"classify_tracked\", \"frames\": %d, \"hold\": %d", 
+              (int)frames.size (), hold);
+    report ("detect", params, tracked_samples, n ? (double)tracked_allocs / (n * hold) : 0.0);
+    
+    snprintf (params, sizeof(params), "\"stage\": \"contours_tracked\", \"frames\": %d, \"hold\": %d", 
+              (int)frames.size (), hold);
+    report ("detect", params, still_samples, n ? (double)still_allocs / (n * hold) : 0.0);
+    
+    int reference_arrows = 0;
+    for (size_t f = 0; f < frames.size (); f++)
+        reference_arrows += reference[f].size ();
+    for (int levels = 1; levels <= max_levels; levels++)
+    {
+        snprintf (params, sizeof(params), "\"stage\": \"total_pyramid\", \"frames\": %d, \"levels\": %d, "
+                  "\"matched\": %d, \"missed\": %d, \"extra\": %d", (int)frames.size (), levels, 
+                  matched[levels], reference_arrows - matched[levels], extra[levels]);
+        report ("detect", params, pyramid_samples[levels], n ? (double)pyramid_allocs[levels] / n : 0.0);
+    }
+    snprintf (params, sizeof(params), "\"stage\": \"components\", \"frames\": %d, "
+              "\"matched\": %d, \"missed\": %d, \"extra\": %d", (int)frames.size (), 
+              component_matched, reference_arrows - component_matched, component_extra);
+    report ("detect", params, component_samples, n ? (double)component_allocs / n : 0.0);
+    for (int s = 0; s < num_stripe_threads; s++)
+    {
+        double serial_ms = median (striped_serial_samples[s]), striped_ms = median (striped_samples[s]);
+        snprintf (params, sizeof(params), "\"stage\": \"edges_striped\", \"frames\": %d, \"threads\": %d, "
+                  "\"mismatched_pixels\": %d, \"serial_p50_ms\": %.4f, \"speedup\": %.2f", (int)frames.size (), 
+                  stripe_threads[s], striped_mismatched[s], serial_ms, striped_ms > 0 ? serial_ms / striped_ms : 0.0);
+        report ("detect", params, striped_samples[s], n ? (double)striped_allocs[s] / n : 0.0);
+    }
+    for (int s = 0; s < num_scales; s++)
+    {
+        snprintf (params, sizeof(params), "\"stage\": \"total_scaled\", \"frames\": %d, \"scale\": %.3f, "
+                  "\"matched\": %d, \"missed\": %d, \"extra\": %d", (int)frames.size (), scales[s], 
+                  scaled_matched[s], reference_arrows - scaled_matched[s], scaled_extra[s]);
+        report ("detect", params, scaled_samples[s], n ? (double)scaled_allocs[s] / n : 0.0);
+    }
+    return true;
+}
+
+static void count_lines (void *ctx, const mazepublic_t *batch)
+{
+    *(long *)ctx += batch->numlines;
+}
+
+static void bench_maze (int max_side, int iterations)
+{
+    static const int sides[] = {10, 30, 100, 300, 1000, 3000, 10000};
+    
+    srand (1);
+    for (size_t s = 0; s < sizeof(sides)/sizeof(*sides) && sides[s] <= max_side; s++)
+    {
+        int side = sides[s];
+        vector<double> gen_samples, trace_samples, edit_samples;
+        unsigned long gen_allocs = 0, trace_allocs = 0, edit_allocs = 0;
+        
+        // The distances for hints and progress get worked out on a maze's
+        // first trace; this times that on its own, one per engine as below
+        vector<double> dist_samples[4];
+        auto time_distances = [&] (int engine)
+        {
+            mazepublic_t trace;
+            timestamp_t t = chrono::steady_clock::now ();
+            maze_trace (0, NULL, &trace, NULL);
+            dist_samples[engine].push_back (ms_since (t));
+        };
+        
+        // A long wandering list of arrows, most of which bump into walls
+        arrowvec_t arrows (4 * side);
+        for (size_t i = 0; i < arrows.size (); i++)
+            arrows[i].dir = (arrowdir_t)(rand () % 4);
+        
+        set_maze_engine (maze_prim);
+        for (int it = 0; it < iterations; it++)
+        {
+            mazepublic_t maze, trace;
+            maze_progress_t progress;
+            
+            unsigned long allocs_before = alloc_count ();
+            timestamp_t t = chrono::steady_clock::now ();
+            cleanup_maze ();
+            generate_maze_seeded (side, side, it + 1, &maze);
+            gen_samples.push_back (ms_since (t));
+            gen_allocs += alloc_count () - allocs_before;
+            time_distances (0);
+            
+            allocs_before = alloc_count ();
+            t = chrono::steady_clock::now ();
+            maze_trace (arrows.size (), &arrows[0], &trace, &progress);
+            trace_samples.push_back (ms_since (t));
+            trace_allocs += alloc_count () - allocs_before;
+            
+            // What a typical frame after that looks like: the last few 
+            // arrows changed, everything before them the same
+            size_t edited = min (arrows.size (), (size_t)3);
+            for (size_t i = arrows.size () - edited; i < arrows.size (); i++)
+                arrows[i].dir = (arrowdir_t)((arrows[i].dir + 1) % 4);
+            allocs_before = alloc_count ();
+            t = chrono::steady_clock::now ();
+            maze_trace (arrows.size (), &arrows[0], &trace, &progress);
+            edit_samples.push_back (ms_since (t));
+            edit_allocs += alloc_count () - allocs_before;
+        }
+        
+        // The same again with Eller's algorithm, kept in memory and 
+        // streamed
+        vector<double> eller_samples, stream_samples;
+        unsigned long eller_allocs = 0, stream_allocs = 0;
+        set_maze_engine (maze_eller);
+        for (int it = 0; it < iterations; it++)
+        {
+            mazepublic_t maze;
+            unsigned long allocs_before = alloc_count ();
+            timestamp_t t = chrono::steady_clock::now ();
+            cleanup_maze ();
+            generate_maze_seeded (side, side, it + 1, &maze);
+            eller_samples.push_back (ms_since (t));
+            eller_allocs += alloc_count () - allocs_before;
+            time_distances (1);
+            
+            long numlines = 0;
+            allocs_before = alloc_count ();
+            t = chrono::steady_clock::now ();
+            stream_maze (side, side, it + 1, count_lines, &numlines);
+            stream_samples.push_back (ms_since (t));
+            stream_allocs += alloc_count () - allocs_before;
+        }
+        
+        // And tiled, on one thread and on all of them
+        vector<double> tiled_samples[2];
+        unsigned long tiled_allocs[2] = {0, 0};
+        set_maze_engine (maze_tiled);
+        for (int threads = 0; threads < 2; threads++)
+        {
+            set_maze_tiling (256, 1 - threads);
+            for (int it = 0; it < iterations; it++)
+            {
+                mazepublic_t maze;
+                unsigned long allocs_before = alloc_count ();
+                timestamp_t t = chrono::steady_clock::now ();
+                cleanup_maze ();
+                generate_maze_seeded (side, side, it + 1, &maze);
+                tiled_samples[threads].push_back (ms_since (t));
+                tiled_allocs[threads] += alloc_count () - allocs_before;
+                time_distances (2 + threads);
+            }
+        }
+        set_maze_tiling (256, 0);
+        set_maze_engine (maze_auto);
+        
+        char params[128];
+        snprintf (params, sizeof(params), "\"engine\": \"prim\", \"width\": %d, \"height\": %d", side, side);
+        report ("generate_maze", params, gen_samples, (double)gen_allocs / iterations);
+        snprintf (params, sizeof(params), "\"engine\": \"eller\", \"width\": %d, \"height\": %d", side, side);
+        report ("generate_maze", params, eller_samples, (double)eller_allocs / iterations);
+        snprintf (params, sizeof(params), "\"engine\": \"tiled\", \"threads\": 1, \"width\": %d, \"height\": %d", side, side);
+        report ("generate_maze", params, tiled_samples[0], (double)tiled_allocs[0] / iterations);
+        snprintf (params, sizeof(params), "\"engine\": \"tiled\", \"threads\": \"all\", \"width\": %d, \"height\": %d", side, side);
+        report ("generate_maze", params, tiled_samples[1], (double)tiled_allocs[1] / iterations);
+        snprintf (params, sizeof(params), "\"engine\": \"eller\", \"width\": %d, \"height\": %d", side, side);
+        report ("stream_maze", params, stream_samples, (double)stream_allocs / iterations);
+        const char *dist_engines[] = {"\"prim\"", "\"eller\"", "\"tiled\", \"threads\": 1", "\"tiled\", \"threads\": \"all\""};
+        for (int e = 0; e < 4; e++)
+        {
+            snprintf (params, sizeof(params), "\"engine\": %s, \"width\": %d, \"height\": %d", dist_engines[e], side, side);
+            report ("maze_distances", params, dist_samples[e], 0);
+        }
+        snprintf (params, sizeof(params), "\"width\": %d, \"height\": %d, \"arrows\": %d", side, side, (int)arrows.size ());
+        report ("maze_trace", params, trace_samples, (double)trace_allocs / iterations);
+        report ("maze_trace_edit", params, edit_samples, (double)edit_allocs / iterations);
+    }
+    cleanup_maze ();
+    free_maze_buffers ();
+}
+
+// Getting a frame's brightness out of a video source, both by decoding to 
+// BGR and converting back and by taking the luma plane as it is. Each pass
+// opens the source again and reads it to the end.
+static bool bench_capture (const char *spec, int iterations)
+{
+    const char *paths[] = {"bgr", "luma"};
+    for (int p = 0; p < 2; p++)
+    {
+        vector<double> samples;
+        unsigned long allocs = 0;
+        for (int it = 0; it < iterations; it++)
+        {
+            frame_source_t *source = open_frame_source (spec);
+            if (!source)
+                return false;
+            Mat bgr, gray;
+            frame_lease_t lease;
+            while (true)
+            {
+                timestamp_t t = chrono::steady_clock::now ();
+                unsigned long a = alloc_count ();
+                if (p == 0)
+                {
+                    if (!source->getframe (bgr))
+                        break;
+                    cvtColor (bgr, gray, CV_BGR2GRAY);
+                }
+                else if (!source->getluma (gray, lease))
+                    break;
+                samples.push_back (ms_since (t));
+                allocs += alloc_count () - a;
+            }
+            lease.reset ();
+            delete source;
+        }
+        
+        char params[512];
+        snprintf (params, sizeof(params), "\"path\": \"%s\", \"source\": \"%s\"", paths[p], spec);
+        report ("capture", params, samples, samples.empty () ? 0.0 : (double)allocs / samples.size ());
+    }
+    return true;
+}
+
+// Aggregate throughput as more sessions share the same threads: each 
+// session plays its own synthetic worksheet through detection and its own
+// maze. With enough cores, frames per second in all should grow with the 
+// number of sessions until every core is busy.
+static void bench_sessions (int iterations, int max_sessions)
+{
+    const int frames = 60;
+    int threads = max (1u, thread::hardware_concurrency ());
+    char spec[32];
+    snprintf (spec, sizeof(spec), "synth:%d", frames);
+    
+    for (int num_sessions = 1; num_sessions <= max_sessions; num_sessions *= 2)
+    {
+        vector<double> samples;
+        unsigned long allocs = 0;
+        int total_frames = 0;
+        for (int it = 0; it < iterations; it++)
+        {
+            session_scheduler_t scheduler;
+            for (int i = 0; i < num_sessions; i++)
+                scheduler.add (open_frame_source (spec), 6, i + 1);
+            
+            timestamp_t t = chrono::steady_clock::now ();
+            unsigned long a = alloc_count ();
+            scheduler.run (threads, 0);
+            samples.push_back (ms_since (t));
+            allocs += alloc_count () - a;
+            for (int i = 0; i < scheduler.size (); i++)
+                total_frames += scheduler.get (i)->frames;
+        }
+        
+        double total_ms = 0;
+        for (size_t i = 0; i < samples.size (); i++)
+            total_ms += samples[i];
+        char params[256];
+        snprintf (params, sizeof(params), "\"sessions\": %d, \"threads\": %d, \"frames_per_session\": %d, \"aggregate_fps\": %.2f",
+                  num_sessions, threads, frames, total_ms > 0 ? 1000.0 * total_frames / total_ms : 0.0);
+        report ("sessions", params, samples, (double)allocs / max (1, total_frames));
+    }
+}
+
+static void usage (const char *argv0)
+{
+    cout << "usage: " << argv0 << " [--corpus DIR] [--iterations N] [--max-maze N] [--only detect|maze|capture|sessions]" << endl
+         << "                [--capture SPEC] [--max-sessions N]" << endl
+         << "  --corpus DIR    recorded frames to run detection on (default bench_corpus)" << endl
+         << "  --iterations N  passes over the corpus, and mazes per size (default 10)" << endl
+         << "  --max-maze N    largest maze side length to benchmark (default 1000)" << endl
+         << "  --max-sessions N  most stations to run at once on synthetic input, doubling" << endl
+         << "                  from 1 (default 8)" << endl
+         << "  --capture SPEC  frame source to time capture on, e.g. y4m:PATH (skipped if" << endl
+         << "                  not given)" << endl;
+}
+
+int main (int argc, char *argv[])
+{
+    const char *corpus = "bench_corpus";
+    const char *only = NULL, *capture = NULL;
+    int iterations = 10, max_maze = 1000, max_sessions = 8;
+    
+    for (int arg = 1; arg < argc; arg++)
+    {
+        if (!strcmp (argv[arg], "--corpus") && arg + 1 < argc)
+            corpus = argv[++arg];
+        else if (!strcmp (argv[arg], "--iterations") && arg + 1 < argc)
+            iterations = max (1, atoi (argv[++arg]));
+        else if (!strcmp (argv[arg], "--max-maze") && arg + 1 < argc)
+            max_maze = atoi (argv[++arg]);
+        else if (!strcmp (argv[arg], "--max-sessions") && arg + 1 < argc)
+            max_sessions = atoi (argv[++arg]);
+        else if (!strcmp (argv[arg], "--capture") && arg + 1 < argc)
+            capture = argv[++arg];
+        else if (!strcmp (argv[arg], "--only") && arg + 1 < argc)
+            only = argv[++arg];
+        else
+        {
+            usage (argv[0]);
+            return 1;
+        }
+    }
+    
+    if (!only || !strcmp (only, "detect"))
+    {
+        if (!bench_detect (corpus, iterations))
+            return 1;
+    }
+    if (!only || !strcmp (only, "maze"))
+        bench_maze (max_maze, iterations);
+    if (!only || !strcmp (only, "sessions"))
+        bench_sessions (iterations, max_sessions);
+    if (capture && (!only || !strcmp (only, "capture")))
+    {
+        if (!bench_capture (capture, iterations))
+            return 1;
+    }
+    
+    return 0;
+}
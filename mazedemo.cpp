@@ -27,14 +27,44 @@ THE SOFTWARE.
 #include <iostream>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <signal.h>
 #include <thread>
+#include <chrono>
 #include "mazedemo_common.h"
+#include "trace.h"
 
 using namespace cv;
 using namespace std;
 
-// Measured in grid cells
-int maze_side;
+// Measured in grid cells. Only the one maze shown in the window; sessions
+// each keep their own.
+static int maze_side;
+
+// With --maze-seed, the Nth maze of the session is built from seed + N, so 
+// a run can be repeated maze for maze
+static bool maze_seeded = false;
+static uint64_t maze_seed;
+
+static double ms_since (timestamp_t t)
+{
+    return chrono::duration<double, milli> (chrono::steady_clock::now () - t).count ();
+}
+
+// Detection steps down to a smaller size whenever frames take longer than
+// this from capture to result (--latency-budget)
+static latency_governor_t governor;
+
+static void update_governor (timestamp_t capture_time)
+{
+    if (governor.update (ms_since (capture_time)))
+        printf ("Detecting at %d%% size\n", (int)(100 * governor.scale ()));
+}
+
+// The picture of what detection saw, under the camera view. 'v' toggles it
+// at runtime; with it off, nothing at all gets drawn for it.
+static bool show_visualization = true;
 
 void draw_maze_lines (Mat &canvas, mazepublic_t &maze, Scalar color)
 {
@@ -47,29 +77,471 @@ void draw_maze_lines (Mat &canvas, mazepublic_t &maze, Scalar color)
     }
 }
 
-void redraw_maze (Mat &canvas, mazepublic_t &maze, mazepublic_t &trace)
+// A bar along the top for how much of the way there the trace is, and once
+// it's taken a wrong turn, a pointer from where it ends the way it should 
+// go next
+static void draw_progress (Mat &canvas, const maze_progress_t &progress)
 {
+    if (progress.start_dist <= 0)
+        return;
+    
     double scale = (double)canvas.size ().height/(double)(maze_side+2);
-    canvas.setTo (Scalar (0, 0, 0));
-    putText (canvas, "START", Point (scale, 0.5*scale), 0, scale/90.0, Scalar (0, 0, 255));
-    draw_maze_lines (canvas, maze, Scalar (0, 255, 0));
+    double done = max (0.0, 1.0 - (double)progress.dist/progress.start_dist);
+    rectangle (canvas, Point (scale, 0.1*scale), Point (scale + done*maze_side*scale, 0.25*scale), Scalar (0, 255, 255), CV_FILLED);
+    char to_go[32];
+    snprintf (to_go, sizeof(to_go), "%d TO GO", progress.dist);
+    putText (canvas, to_go, Point (scale, (maze_side+1.5)*scale), 0, scale/90.0, Scalar (0, 255, 255));
+    
+    if (progress.first_wrong < 0 || progress.hint < 0)
+        return;
+    // Same units as draw_maze_lines
+    double unit = canvas.size ().height/(maze_side+2)/4;
+    Point2f from (4*progress.end[0]+6, 4*progress.end[1]+6), to = from;
+    switch (progress.hint)
+    {
+        case arrow_up:
+            to.y -= 3;
+            break;
+        case arrow_down:
+            to.y += 3;
+            break;
+        case arrow_right:
+            to.x += 3;
+            break;
+        case arrow_left:
+            to.x -= 3;
+            break;
+    }
+    circle (canvas, unit*from, unit, Scalar (0, 255, 255), CV_FILLED, CV_AA);
+    line (canvas, unit*from, unit*to, Scalar (0, 255, 255), 2, CV_AA);
+}
+
+// The maze itself only changes when a new one is generated, so it's drawn
+// once into here, and each frame starts from a copy of it. That way 
+// redrawing costs the same however big the maze is.
+static Mat maze_layer;
+static bool maze_layer_stale = true;
+
+void redraw_maze (Mat &canvas, mazepublic_t &maze, mazepublic_t &trace, const maze_progress_t &progress)
+{
+    if (maze_layer_stale || maze_layer.size () != canvas.size () || maze_layer.type () != canvas.type ())
+    {
+        TRACE_SCOPE ("maze_layer");
+        double scale = (double)canvas.size ().height/(double)(maze_side+2);
+        maze_layer.create (canvas.size (), canvas.type ());
+        maze_layer.setTo (Scalar (0, 0, 0));
+        putText (maze_layer, "START", Point (scale, 0.5*scale), 0, scale/90.0, Scalar (0, 0, 255));
+        draw_maze_lines (maze_layer, maze, Scalar (0, 255, 0));
+        putText (maze_layer, "END", Point (maze_side*scale, (maze_side+1.5)*scale), 0, scale/90.0, Scalar (0, 255, 0));
+        maze_layer_stale = false;
+    }
+    maze_layer.copyTo (canvas);
     draw_maze_lines (canvas, trace, Scalar (0, 0, 255));
-    putText (canvas, "END", Point (maze_side*scale, (maze_side+1.5)*scale), 0, scale/90.0, Scalar (0, 255, 0));
+    draw_progress (canvas, progress);
 }
 
-void regenerate_maze (mazepublic_t *maze, mazepublic_t *trace)
+void regenerate_maze (mazepublic_t *maze, mazepublic_t *trace, maze_progress_t *progress = NULL)
 {
     cleanup_maze ();
-    generate_maze (maze_side, maze_side, maze);
+    if (maze_seeded)
+        generate_maze_seeded (maze_side, maze_side, maze_seed++, maze);
+    else
+        generate_maze (maze_side, maze_side, maze);
     memset (trace, 0, sizeof(*trace));
+    maze_layer_stale = true;
+    if (progress)
+    {
+        // Nothing to show until the first trace
+        memset (progress, 0, sizeof(*progress));
+        progress->first_wrong = progress->hint = -1;
+    }
+}
+
+// Heap allocations per frame, not counting the first few frames while the 
+// buffers grow to size. alloc_count.o counts every one in the process, 
+// OpenCV's included. Once warmed up, detection and tracing make none, so a
+// headless run from the synthetic or YUV file source should read 0; other
+// sources allocate decoding (or, for V4L2, leasing) each frame, and the 
+// windows allocate drawing and showing it.
+static const int warmup_frames = 30;
+static unsigned long warm_allocs, last_allocs;
+static int counted_frames;
+
+// Call at the start of every frame
+static void count_allocs (int frame)
+{
+    if (frame == warmup_frames)
+        warm_allocs = alloc_count ();
+    else if (frame > warmup_frames)
+    {
+        last_allocs = alloc_count ();
+        counted_frames = frame - warmup_frames;
+    }
+}
+
+static void report_fps (int frames, timestamp_t start)
+{
+    double secs = chrono::duration<double> (chrono::steady_clock::now () - start).count ();
+    printf ("%d frames in %.3f s: %.2f fps\n", frames, secs, secs > 0 ? frames / secs : 0.0);
+    if (counted_frames > 0)
+        printf ("%.2f heap allocations per frame after the first %d frames\n", 
+                (double)(last_allocs - warm_allocs) / counted_frames, warmup_frames);
+}
+
+// A trace of the last few seconds gets written out whenever someone sends
+// us SIGUSR1 or presses 't', and at exit if --trace was given.
+static const char *trace_path = "mazedemo_trace.json";
+static volatile sig_atomic_t trace_requested = 0;
+
+static void request_trace (int sig)
+{
+    trace_requested = 1;
+}
+
+static void check_trace_request (void)
+{
+    if (trace_requested)
+    {
+        trace_requested = 0;
+        trace_dump (trace_path);
+    }
+}
+
+// Saves captured frames so they can be added to the benchmark corpus
+static void record_frame (const char *record_dir, int frame_num, const Mat &frame)
+{
+    char path[PATH_MAX];
+    snprintf (path, sizeof(path), "%s/frame_%05d.png", record_dir, frame_num);
+    imwrite (path, frame);
+}
+
+// No highgui windows at all. By default every frame goes through detection
+// and tracing on this thread; with a pipeline, frames are submitted as fast 
+// as they're decoded and the pipeline keeps up as best it can. Either way 
+// the source can be paced to its native frame rate instead.
+static int run_headless (frame_source_t *source, bool paced, int max_frames, const char *record_dir, bool dump_trace, bool use_pipeline, pipeline_mode_t mode)
+{
+    arrowvec_t arrows;
+    detect_state_t state;
+    detect_pipeline_t pipeline;
+    if (use_pipeline)
+        pipeline.start (mode);
+    
+    mazepublic_t maze, trace;
+    regenerate_maze (&maze, &trace);
+    
+    double fps = source->native_fps ();
+    if (paced && fps <= 0)
+    {
+        cout << "Source has no native frame rate, running unpaced" << endl;
+        paced = false;
+    }
+    
+    timestamp_t start = chrono::steady_clock::now ();
+    timestamp_t deadline = start;
+    int frames = 0, processed = 0, solved = 0, last_result = 0;
+    double total_latency = 0;
+    
+    auto handle_result = [&] (timestamp_t capture_time)
+    {
+        total_latency += ms_since (capture_time);
+        update_governor (capture_time);
+        processed++;
+        TRACE_SCOPE ("maze_trace");
+        if (maze_trace (arrows.size (), arrows.empty () ? NULL : &arrows[0], &trace, NULL))
+        {
+            solved++;
+            regenerate_maze (&maze, &trace);
+        }
+    };
+    
+    // Sources that have the luma plane on hand skip the colour decode 
+    // altogether, and their frames go to detection without being copied.
+    // With the pipeline, frames that come in while it's busy aren't decoded
+    // at all.
+    bool luma = source->has_luma ();
+    Mat src, src_gray;
+    frame_lease_t lease;
+    int last_submitted = 0;
+    while (max_frames == 0 || frames < max_frames)
+    {
+        check_trace_request ();
+        TRACE_FRAME (frames + 1);
+        {
+            TRACE_SCOPE ("capture");
+            if (!source->grab ())
+                break;
+        }
+        frames++;
+        count_allocs (frames);
+        timestamp_t capture_time = chrono::steady_clock::now ();
+        bool process = !use_pipeline || pipeline.wants_input ();
+        if (process || record_dir)
+        {
+            TRACE_SCOPE ("retrieve");
+            if (luma ? !source->retrieve_luma (src_gray, lease) : !source->retrieve (src))
+                break;
+        }
+        if (record_dir)
+            record_frame (record_dir, frames, luma ? src_gray : src);
+        
+        if (use_pipeline)
+        {
+            if (process)
+            {
+                TRACE_SCOPE ("submit");
+                detect_input_t &in = pipeline.input_slot ();
+                in.frame_num = frames;
+                in.capture_time = capture_time;
+                in.scale = governor.scale ();
+                if (luma)
+                {
+                    in.gray = src_gray;
+                    in.lease = lease;
+                    lease.reset ();
+                }
+                else
+                    src.copyTo (in.bgr);
+                pipeline.submit ();
+                last_submitted = frames;
+            }
+            
+            detect_result_t *result = pipeline.poll ();
+            if (result)
+            {
+                last_result = result->frame_num;
+                arrows.swap (result->arrows);
+                handle_result (result->capture_time);
+            }
+        }
+        else
+        {
+            if (!luma)
+            {
+                TRACE_SCOPE ("cvtColor");
+                cvtColor (src, src_gray, CV_BGR2GRAY);
+            }
+            state.scale = governor.scale ();
+            do_process (src_gray, arrows, &state);
+            handle_result (capture_time);
+        }
+        
+        if (paced)
+        {
+            deadline += chrono::microseconds ((long long)(1000000.0 / fps));
+            this_thread::sleep_until (deadline);
+        }
+    }
+    
+    if (use_pipeline)
+    {
+        // Out of frames; give the pipeline a chance to finish the last one
+        timestamp_t give_up = chrono::steady_clock::now () + chrono::seconds (2);
+        while (last_result != last_submitted && chrono::steady_clock::now () < give_up)
+        {
+            detect_result_t *result = pipeline.poll ();
+            if (!result)
+            {
+                this_thread::sleep_for (chrono::milliseconds (1));
+                continue;
+            }
+            last_result = result->frame_num;
+            arrows.swap (result->arrows);
+            handle_result (result->capture_time);
+        }
+        pipeline.stop ();
+    }
+    lease.reset ();
+    if (dump_trace)
+        trace_dump (trace_path);
+    
+    report_fps (frames, start);
+    printf ("%d frames processed, %.2f ms average latency, %d mazes solved\n", 
+            processed, processed ? total_latency / processed : 0.0, solved);
+    return 0;
 }
 
-Mat processing_visualization_area;
+static void usage (const char *argv0)
+{
+    cout << "usage: " << argv0 << " [--source SPEC] [--headless] [--paced] [--frames N] [--maze-size N]" << endl
+         << "                [--pipeline serial|staged] [--incremental] [--pyramid N] [--track]" << endl
+         << "                [--components] [--edge-threads N] [--maze-seed N] [--maze-engine prim|eller|tiled] [--no-visualization]" << endl
+         << "                [--record DIR] [--trace FILE] [--capture-size WxH] [--latency-budget MS]" << endl
+         << "       " << argv0 << " --session SPEC [--session SPEC...] [--threads N] [--frames N]" << endl
+         << "                [--maze-seed N] [--maze-size N] [--incremental] [--pyramid N] [--track]" << endl
+         << "       " << argv0 << " --batch [--threads N] [--maze-seed N] [--maze-size N] [--pyramid N] PATH..." << endl
+         << "  SPEC is cam[:N] (default), video:PATH, dir:PATH, synth[:FRAMES]," << endl
+         << "  v4l2[:DEVICE], y4m:PATH or yuv:WxH:PATH (raw I420)" << endl
+         << "  --headless  no windows; process every frame as fast as possible" << endl
+         << "  --paced     in headless mode, play back at the source's native rate" << endl
+         << "  --frames N  stop after N frames" << endl
+         << "  --maze-seed N  generate the same sequence of mazes every run" << endl
+         << "  --maze-engine  prim, eller, which builds the maze a row at a time, or tiled," << endl
+         << "                 which builds 256x256 tiles on every core and joins them" << endl
+         << "                 (default: prim up to 1024x1024 cells, tiled above)" << endl
+         << "  --pipeline  serial: one worker thread runs every stage" << endl
+         << "              staged: one thread per stage (default with windows)" << endl
+         << "              Headless mode processes inline unless this is given." << endl
+         << "  --incremental  only re-detect the parts of the frame that changed" << endl
+         << "  --pyramid N    find arrows at 1/2^N size (N up to 3), then refine each" << endl
+         << "                 one at full size; ignored with --incremental" << endl
+         << "  --track        follow arrows from frame to frame, and only reclassify" << endl
+         << "                 the ones that are new or have moved" << endl
+         << "  --components   find arrows by labelling connected blobs of edges in one" << endl
+         << "                 pass, instead of tracing and simplifying their outlines" << endl
+         << "  --edge-threads N  split edge detection into stripes on N threads (0 for" << endl
+         << "                 one per core); the edges come out exactly the same" << endl
+         << "  --capture-size WxH  camera resolution to ask for (default 1280x720); the" << endl
+         << "                 size thresholds and the window layout follow whatever size" << endl
+         << "                 the source's frames turn out to be" << endl
+         << "  --latency-budget MS  shrink the frame before detection, in steps down to" << endl
+         << "                 a quarter, whenever capture to result takes longer than MS," << endl
+         << "                 and grow it back once there's room; not with --incremental" << endl
+         << "                 or --pyramid" << endl
+         << "  --no-visualization  don't draw what detection saw ('v' toggles it)" << endl
+         << "  --batch     grade scanned worksheets instead: each PATH is an image, a" << endl
+         << "              directory of them or a file listing them, all traced through" << endl
+         << "              the same maze (seed 1 by default), one JSON line per image" << endl
+         << "  --session   run a station on SPEC, headless; give it once per station" << endl
+         << "              to run them all on one pool of threads, each with its own maze" << endl
+         << "  --threads N threads for --session or --batch (default one per core)" << endl
+         << "  --record    save every captured frame as a PNG in DIR" << endl
+         << "  --trace     write a Chrome trace of the last few seconds to FILE at exit" << endl
+         << "              (also written on 't' or SIGUSR1, to mazedemo_trace.json by default)" << endl;
+}
 
 int main (int argc, char *argv[])
 {
-    if (!camera_setup ())
-        return 0;
+    const char *source_spec = "cam";
+    const char *record_dir = NULL;
+    bool headless = false, paced = false, use_pipeline = false, dump_trace = false;
+    pipeline_mode_t mode = pipeline_staged;
+    int max_frames = 0;
+    maze_side = 6;
+    bool batch = false;
+    int num_threads = 0;
+    vector<string> batch_inputs, session_specs;
+    
+    for (int arg = 1; arg < argc; arg++)
+    {
+        if (!strcmp (argv[arg], "--source") && arg + 1 < argc)
+            source_spec = argv[++arg];
+        else if (!strcmp (argv[arg], "--headless"))
+            headless = true;
+        else if (!strcmp (argv[arg], "--paced"))
+            paced = true;
+        else if (!strcmp (argv[arg], "--incremental"))
+            detect_config.incremental = true;
+        else if (!strcmp (argv[arg], "--track"))
+            detect_config.track = true;
+        else if (!strcmp (argv[arg], "--components"))
+            detect_config.components = true;
+        else if (!strcmp (argv[arg], "--edge-threads") && arg + 1 < argc)
+        {
+            detect_config.edge_threads = atoi (argv[++arg]);
+            if (detect_config.edge_threads <= 0)
+                detect_config.edge_threads = thread::hardware_concurrency ();
+        }
+        else if (!strcmp (argv[arg], "--no-visualization"))
+            show_visualization = false;
+        else if (!strcmp (argv[arg], "--pyramid") && arg + 1 < argc)
+            detect_config.pyramid_levels = min (3, max (0, atoi (argv[++arg])));
+        else if (!strcmp (argv[arg], "--trace") && arg + 1 < argc)
+        {
+            trace_path = argv[++arg];
+            dump_trace = true;
+        }
+        else if (!strcmp (argv[arg], "--capture-size") && arg + 1 < argc)
+        {
+            int width, height;
+            if (sscanf (argv[++arg], "%dx%d", &width, &height) != 2 || width < 16 || height < 16)
+            {
+                usage (argv[0]);
+                return 1;
+            }
+            set_capture_size (width, height);
+        }
+        else if (!strcmp (argv[arg], "--latency-budget") && arg + 1 < argc)
+            governor.set_budget (atof (argv[++arg]));
+        else if (!strcmp (argv[arg], "--record") && arg + 1 < argc)
+            record_dir = argv[++arg];
+        else if (!strcmp (argv[arg], "--frames") && arg + 1 < argc)
+            max_frames = atoi (argv[++arg]);
+        else if (!strcmp (argv[arg], "--maze-seed") && arg + 1 < argc)
+        {
+            maze_seeded = true;
+            maze_seed = strtoull (argv[++arg], NULL, 0);
+        }
+        else if (!strcmp (argv[arg], "--maze-engine") && arg + 1 < argc && !strcmp (argv[arg+1], "prim"))
+        {
+            set_maze_engine (maze_prim);
+            arg++;
+        }
+        else if (!strcmp (argv[arg], "--maze-engine") && arg + 1 < argc && !strcmp (argv[arg+1], "eller"))
+        {
+            set_maze_engine (maze_eller);
+            arg++;
+        }
+        else if (!strcmp (argv[arg], "--maze-engine") && arg + 1 < argc && !strcmp (argv[arg+1], "tiled"))
+        {
+            set_maze_engine (maze_tiled);
+            arg++;
+        }
+        else if (!strcmp (argv[arg], "--maze-size") && arg + 1 < argc)
+            maze_side = max (3, atoi (argv[++arg]));
+        else if (!strcmp (argv[arg], "--pipeline") && arg + 1 < argc && !strcmp (argv[arg+1], "serial"))
+        {
+            use_pipeline = true;
+            mode = pipeline_serial;
+            arg++;
+        }
+        else if (!strcmp (argv[arg], "--pipeline") && arg + 1 < argc && !strcmp (argv[arg+1], "staged"))
+        {
+            use_pipeline = true;
+            mode = pipeline_staged;
+            arg++;
+        }
+        else if (!strcmp (argv[arg], "--batch"))
+            batch = true;
+        else if (!strcmp (argv[arg], "--threads") && arg + 1 < argc)
+            num_threads = atoi (argv[++arg]);
+        else if (!strcmp (argv[arg], "--session") && arg + 1 < argc)
+            session_specs.push_back (argv[++arg]);
+        else if (batch && argv[arg][0] != '-')
+            batch_inputs.push_back (argv[arg]);
+        else
+        {
+            usage (argv[0]);
+            return 1;
+        }
+    }
+    
+    if (batch)
+    {
+        if (batch_inputs.empty ())
+        {
+            usage (argv[0]);
+            return 1;
+        }
+        return run_batch (batch_inputs, maze_seeded ? maze_seed : 1, maze_side, num_threads);
+    }
+    if (!session_specs.empty ())
+        return run_sessions (session_specs, maze_seeded, maze_seed, maze_side, num_threads, max_frames);
+    
+    TRACE_THREAD_NAME ("ui");
+    signal (SIGUSR1, request_trace);
+    
+    frame_source_t *source = open_frame_source (source_spec);
+    if (!source)
+        return 1;
+    fit_capture_size (source);
+    
+    if (headless)
+    {
+        int ret = run_headless (source, paced, max_frames, record_dir, dump_trace, use_pipeline, mode);
+        delete source;
+        return ret;
+    }
     
     char *source_window = "Source";
     char *maze_trackbar = "Maze Size";
@@ -78,36 +550,85 @@ int main (int argc, char *argv[])
     // older openCV is missing this API
     resizeWindow (source_window, cfg_w/2+cfg_h, cfg_h);
 #endif
-    maze_side = 6;
     createTrackbar (maze_trackbar, source_window, &maze_side, 10);
     int last_maze_side = maze_side;
     
     Mat display (Size (cfg_w/2+cfg_h, cfg_h), CV_8UC3);
 
     Mat camera_display_area = display (Rect (0, 0, cfg_w/2, cfg_h/2));
-    processing_visualization_area = display (Rect (0, cfg_h/2, cfg_w/2, cfg_h/2));
+    Mat processing_visualization_area = display (Rect (0, cfg_h/2, cfg_w/2, cfg_h/2));
     Mat maze_display_area = display (Rect (cfg_w/2, 0, cfg_h, cfg_h));
     
-    Mat process_in;
-    process_done = true;
-    thread worker;
+    detect_pipeline_t pipeline;
+    pipeline.start (mode);
     
     mazepublic_t maze, trace;
-    regenerate_maze (&maze, &trace);
+    maze_progress_t progress;
+    regenerate_maze (&maze, &trace, &progress);
     
+    bool luma = source->has_luma ();
+    Mat src, src_gray;
+    frame_lease_t lease;
+    
+    timestamp_t start = chrono::steady_clock::now ();
     int i = 0;
-    while (true)
+    while (max_frames == 0 || i < max_frames)
     {
+        check_trace_request ();
+        TRACE_FRAME (i + 1);
+        
+        {
+            TRACE_SCOPE ("capture");
+            if (!source->grab ())
+                break;
+        }
         i++;
-        Mat src = camera_getframe ();
-        resize (src, camera_display_area, camera_display_area.size ());
+        count_allocs (i);
+        
+        // Every frame is previewed, but only one the pipeline is ready for 
+        // gets decoded in full (and converted to gray); the preview takes 
+        // whatever shortcut the source has to a small picture. For most
+        // sources that's reusing the full decode when there is one, so it
+        // comes after, but retrieve_luma may give the frame away.
+        bool process = pipeline.wants_input ();
+        if (luma)
+            source->retrieve_preview (camera_display_area);
+        if (process || record_dir)
+        {
+            TRACE_SCOPE ("retrieve");
+            if (luma ? !source->retrieve_luma (src_gray, lease) : !source->retrieve (src))
+                break;
+        }
+        if (!luma)
+            source->retrieve_preview (camera_display_area);
+        if (record_dir)
+            record_frame (record_dir, i, luma ? src_gray : src);
 
-        // Convert image to gray and blur it
-        Mat src_gray;
-        cvtColor (src, src_gray, CV_BGR2GRAY);
+        // Hand the pipeline a copy of the frame (or for luma sources, the 
+        // capture buffer itself.)
+        if (process)
+        {
+            TRACE_SCOPE ("submit");
+            detect_input_t &in = pipeline.input_slot ();
+            in.frame_num = i;
+            in.capture_time = chrono::steady_clock::now ();
+            in.scale = governor.scale ();
+            if (luma)
+            {
+                in.gray = src_gray;
+                in.lease = lease;
+                lease.reset ();
+            }
+            else
+                src.copyTo (in.bgr);
+            pipeline.submit ();
+        }
         
         // Preview camera output
-        imshow (source_window, display);
+        {
+            TRACE_SCOPE ("imshow");
+            imshow (source_window, display);
+        }
         
         // regenerate maze if the user adjusted the maze size setting
         if (maze_side < 3) // because the trackbars always start at 0
@@ -117,49 +638,55 @@ int main (int argc, char *argv[])
         }
         if (maze_side != last_maze_side)
         {
-            regenerate_maze (&maze, &trace);
-            redraw_maze (maze_display_area, maze, trace);
+            regenerate_maze (&maze, &trace, &progress);
+            redraw_maze (maze_display_area, maze, trace, progress);
             last_maze_side = maze_side;
         }
         
-#define WORKER_THREAD
-#ifdef WORKER_THREAD
-        if (process_done)
-        {
-            if (worker.joinable ())
-                worker.join ();
-#else
-        src_gray.copyTo (process_in);
-        if ((i%2) == 0)
+        detect_result_t *result = pipeline.poll ();
+        if (result)
         {
-            do_process (process_in);
-#endif
-            bool victory = maze_trace (process_output.size(), &process_output[0], &trace);
-            redraw_maze (maze_display_area, maze, trace);
+            update_governor (result->capture_time);
+            // Drawn here, on the thread that shows it, so it can't be caught
+            // half done. The result slot stays put until the next poll.
+            if (show_visualization)
+                draw_visualization (result->candidates, result->arrows, processing_visualization_area);
+            bool victory;
+            {
+                TRACE_SCOPE ("maze_trace");
+                victory = maze_trace (result->arrows.size (), result->arrows.empty () ? NULL : &result->arrows[0], &trace, &progress);
+            }
+            {
+                TRACE_SCOPE ("redraw_maze");
+                redraw_maze (maze_display_area, maze, trace, progress);
+            }
             if (victory)
             {
                 putText (display, "MAZE SOLVED (any key to play again)", Point (60, 60), 0, 2.0, Scalar (0,255,255), 3, CV_AA);
                 imshow (source_window, display);
                 waitKey (0);
-                // Flush a couple of frames that the webcam might have buffered
-                for (int j = 0; j < 5; j++)
-                    camera_getframe ();
-                regenerate_maze (&maze, &trace);
+                // Whatever the webcam buffered meanwhile gets skipped by the
+                // next grab, without being decoded
+                regenerate_maze (&maze, &trace, &progress);
             }
-#ifdef WORKER_THREAD
-            process_done = false;
-            src_gray.copyTo (process_in);
-            worker = thread (do_process, process_in);
-#endif
         }
         
-        waitKey(1);
-        //if (i == 100) break;
+        int key = waitKey (1);
+        if (key == 't')
+            trace_requested = 1;
+        else if (key == 'v')
+        {
+            show_visualization = !show_visualization;
+            processing_visualization_area.setTo (Scalar (0, 0, 0));
+        }
     }
     
-#ifdef WORKER_THREAD
-    worker.join ();
-#endif
+    pipeline.stop ();
+    lease.reset ();
+    if (dump_trace)
+        trace_dump (trace_path);
 
+    report_fps (i, start);
+    delete source;
     return(0);
 }
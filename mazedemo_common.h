@@ -22,8 +22,19 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 */
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include "mailbox.h"
+#include "bounded_queue.h"
+
 // Webcam defaults & scaling information
 
 // This is the resolution at which all the magic numbers were calibrated
@@ -31,19 +42,16 @@ const int base_w = 1280;
 const int base_h = 960;
 const int base_area = base_w*base_h;
 
-// This is the resolution at which the camera is configured
-const int cfg_w = 1280;
-const int cfg_h = 720;
-const int cfg_area = cfg_w*cfg_h;
-
-// Magic number scaling factors
-const double scale_len = (double)cfg_h/(double)base_h;
-const double scale_area = (double)cfg_area/(double)base_area;
+// This is the resolution at which the camera is configured, 1280x720 
+// unless set_capture_size says otherwise. Call that before opening any 
+// source or starting any detection, since the magic numbers are only ever
+// scaled once; the one exception is fit_capture_size, which corrects it 
+// to what the source opened actually delivers before detection starts.
+extern int cfg_w, cfg_h;
+void set_capture_size (int width, int height);
 
-// For communicating with the image-processing worker thread
-void do_process (cv::Mat process_in); // worker thread main function
-extern bool process_done; // worker thread sets this when it's done with a frame
-extern cv::Mat processing_visualization_area;
+// Magic number scaling factors, for the configured resolution
+extern double scale_len, scale_area;
 
 extern "C" {
 #endif
@@ -52,6 +60,7 @@ typedef enum {arrow_up, arrow_down, arrow_right, arrow_left} arrowdir_t;
 typedef struct 
 {
     int contour_num;
+    int track_id; // stays the same from frame to frame, -1 if not tracked
     arrowdir_t dir;
     double vert_min, vert_max;
     double origin[2]; 
@@ -65,17 +74,571 @@ typedef struct
     mazeline_t *lines;
 } mazepublic_t;
 
+// out->lines belongs to the maze, and is only valid until the next maze is
+// generated
 void generate_maze (int width, int height, mazepublic_t *out);
+// The same seed always gives the same maze, on any machine
+void generate_maze_seeded (int width, int height, uint64_t seed, mazepublic_t *out);
+
+// Which algorithm generate_maze uses. Prim's needs a few bits per cell of
+// working memory on top of the maze itself; Eller's only ever keeps one 
+// row in memory, and makes mazes with a different feel (longer horizontal
+// runs.) Tiled is Prim's run on square tiles in parallel, then joined up;
+// it's the one for really big mazes, although the tile borders can be made
+// out. Auto, the default, is Prim's up to 1024x1024 cells and tiled above.
+typedef enum {maze_prim, maze_eller, maze_tiled, maze_auto} maze_engine_t;
+void set_maze_engine (maze_engine_t engine);
+
+// Tile size in cells (256 by default) for the tiled engine, and number of
+// threads (0, the default, for one per core) it and the line output of big
+// mazes get to use. The maze only depends on the seed and the tile size.
+void set_maze_tiling (int tile_size, int num_threads);
+
+// Generates a maze with Eller's algorithm without ever holding more than a
+// row of it: the lines come out through sink a row at a time, top to 
+// bottom, in the same order generate_maze would put them in. The batch is
+// only valid during the call. Memory use is O(width), so this works for 
+// mazes far too tall to keep.
+typedef void (*maze_sink_t) (void *ctx, const mazepublic_t *batch);
+void stream_maze (int width, int height, uint64_t seed, maze_sink_t sink, void *ctx);
+// Frees the maze, but keeps the line buffers for the next one
 void cleanup_maze (void);
-bool maze_trace (int num_arrows, arrow_t *arrows, mazepublic_t *out);
+// Frees those as well
+void free_maze_buffers (void);
+
+// How far a trace got. Every cell's distance from the goal is worked out 
+// the first time a maze is traced (a tile at a time in parallel, for tiled
+// mazes), so after that this costs nothing extra to fill in.
+typedef struct
+{
+    int start_dist; // length of the solution
+    int dist; // steps left from where the trace ends
+    int first_wrong; // first arrow that stepped away from the goal, -1 if none did
+    mazepoint_t end; // the cell the trace ends in
+    int hint; // the arrowdir_t of the right next step from there, -1 when solved
+} maze_progress_t;
+
+// progress can be NULL. out->lines belongs to the maze, and stays valid 
+// until the next maze_trace or new maze. Only the arrows from the first
+// one that differs from the last call's get walked again, so call it with 
+// the whole list every time.
+bool maze_trace (int num_arrows, arrow_t *arrows, mazepublic_t *out, maze_progress_t *progress);
+
+// Several mazes at once, say one per camera: each maze_state_t holds a 
+// maze and its trace, and the functions taking one work just like the ones
+// above (which all share a hidden one), except that different states can be
+// used from different threads at the same time. The engine and tiling 
+// settings are shared by all of them. Lines returned belong to the state.
+typedef struct maze_state maze_state_t;
+maze_state_t *new_maze_state (void);
+void free_maze_state (maze_state_t *state);
+void generate_maze_in (maze_state_t *state, int width, int height, uint64_t seed, mazepublic_t *out);
+bool maze_trace_in (maze_state_t *state, int num_arrows, arrow_t *arrows, mazepublic_t *out, maze_progress_t *progress);
+
+// Total heap allocations made by the process so far. Only available in 
+// programs linked with alloc_count.o.
+unsigned long alloc_count (void);
 
 #ifdef __cplusplus
 }
 
 typedef std::vector<arrow_t> arrowvec_t;
-extern arrowvec_t process_output; // All arrows detected
 
-// Webcam capture functions
-bool camera_setup (void); // Returns true on success
-cv::Mat camera_getframe (void); 
+typedef std::chrono::steady_clock::time_point timestamp_t;
+
+// Holds on to a captured buffer for as long as anything still looks at it.
+// Dropping the last copy hands the buffer back to the source it came from,
+// so every lease has to be gone before the source is deleted. An empty 
+// lease means there's nothing to give back.
+typedef std::shared_ptr<void> frame_lease_t;
+
+// The arrow candidates found in a frame, one row per candidate, stored 
+// column by column so the filter and the classifier only ever touch the 
+// fields they use. Candidate i's outline is count[i] points long, starting at
+// points[start[i]]; everything else is computed from it in one pass by 
+// find_candidates.
+class candidate_table_t
+{
+public:
+    std::vector<cv::Point> points;
+    std::vector<int> start, count;
+    std::vector<double> area;
+    std::vector<double> cx, cy; // center of mass
+    std::vector<double> vweight, hweight; // outline length along each axis
+    std::vector<int> x0, y0, x1, y1; // bounding box, x1 and y1 exclusive
+    std::vector<float> darkness; // mean intensity inside the bounding box
+    
+    int size (void) const {return (int)start.size ();}
+    cv::Rect bbox (int i) const {return cv::Rect (x0[i], y0[i], x1[i] - x0[i], y1[i] - y0[i]);}
+    
+    void clear (void);
+    // Appends row i of another table to this one
+    void copy_row (const candidate_table_t &from, int i);
+    // Trades contents (and buffers) with another table
+    void swap (candidate_table_t &other);
+};
+
+// Runtime detection options, set once at startup
+typedef struct
+{
+    bool incremental; // only re-detect the parts of the frame that changed
+    int pyramid_levels; // find candidates at 1/2^n size, 0 for full size
+    bool track; // follow arrows across frames instead of classifying anew
+    bool components; // find candidates by labelling blobs, not tracing outlines
+    int edge_threads; // split detect_edges into stripes on this many threads, 0 or 1 for one
+} detect_config_t;
+extern detect_config_t detect_config;
+
+// Which parts of a frame changed since the last one that was processed
+typedef struct
+{
+    bool full; // re-detect everything; the lists below are empty
+    std::vector<cv::Rect> changed; // tiles that changed
+    std::vector<cv::Rect> regions; // changed tiles plus a halo, to re-detect
+} frame_changes_t;
+
+// Follows arrows from one frame to the next (img_tracker.cpp.) Candidates
+// are matched to the arrows seen in earlier frames by how much their 
+// bounding boxes overlap. An arrow that has sat still for a few frames keeps
+// its direction and isn't classified again, and when one does get 
+// reclassified its direction only flips once the new one has held for a 
+// couple of frames, so a noisy outline can't make the maze trace jump.
+class arrow_tracker_t
+{
+public:
+    // Like classify_candidates, but each arrow also gets a track_id that 
+    // stays the same for as long as it's followed
+    void update (const candidate_table_t &candidates, arrowvec_t &arrows);
+    void reset (void);
+    
+    arrow_tracker_t (void) : next_id (0) {}
+    
+private:
+    typedef struct
+    {
+        int id;
+        cv::Rect bbox;
+        double origin[2]; // smoothed
+        arrowdir_t dir, pending_dir;
+        int pending_frames; // how long pending_dir has been seen instead
+        int still_frames; // how long the bounding box has stayed put
+        int missed_frames; // how long since it was last seen
+        bool matched;
+    } track_t;
+    
+    std::vector<track_t> tracks;
+    int next_id;
+};
+
+// The contour stage's side of tracking (img_tracker.cpp.) An outline whose
+// bounding box has sat still for as long as the tracker takes to stop 
+// reclassifying it isn't simplified and measured again: its row is copied 
+// from the last frame instead. findContours still runs over it, since 
+// that's how we know it's still there.
+class still_candidates_t
+{
+public:
+    // The row of last () that an outline with this bounding box is the same
+    // one as, or -1
+    int match (const cv::Rect &outline) const;
+    // Whether that row has been still long enough to be copied
+    bool settled (int row) const;
+    const candidate_table_t &last (void) const {return last_table;}
+    
+    // Row i of candidates came from an outline with this bounding box, which
+    // matched row matched of last (), or -1 for none
+    void remember (const candidate_table_t &candidates, int i, const cv::Rect &outline, int matched);
+    // What was remembered becomes last ()
+    void next_frame (void);
+    void reset (void);
+    
+private:
+    candidate_table_t last_table, next_table;
+    std::vector<cv::Rect> last_outlines, next_outlines;
+    std::vector<int> last_still, next_still; // frames each has stayed put
+};
+
+// What incremental re-detection and tracking remember from one frame to the
+// next. The edge stage owns the first part, the contour stage the second 
+// and the classify stage the tracker, so in the staged pipeline none of 
+// them needs a lock.
+class detect_state_t
+{
+public:
+    cv::Mat reference, diff; // last gray frame to go through the edge stage
+    int frames_since_full;
+    cv::Mat scratch;
+    std::vector<bool> dirty_tiles; // for find_changes
+    std::vector<int> tile_stack;
+    
+    candidate_table_t cached; // candidates found in that frame
+    candidate_table_t found;
+    still_candidates_t still; // with detect_config.track
+    
+    arrow_tracker_t tracker;
+    
+    // do_process's working space, which the pipeline keeps in its frames 
+    // instead
+    cv::Mat edges, small;
+    frame_changes_t changes;
+    candidate_table_t candidates;
+    
+    // Size to detect at relative to the frame, from latency_governor_t
+    double scale;
+    
+    detect_state_t (void) : frames_since_full (0), scale (1) {}
+};
+
+// Finds all the arrows in a grayscale frame, sorted into reading order. 
+// This is just the stages below run back to back. With a state and 
+// detect_config.incremental, only what changed since the last call with the
+// same state is re-detected, and with detect_config.track the arrows are 
+// followed from call to call. A state->scale under 1 detects in a shrunk 
+// copy of the frame instead, unless incremental or pyramid is on. The 
+// candidates they came from are left in state->candidates, for 
+// draw_visualization.
+void do_process (const cv::Mat &process_in, arrowvec_t &arrows, detect_state_t *state = NULL);
+
+// The stages of do_process, in order. detect_contours clobbers edges.
+void detect_edges (const cv::Mat &gray, cv::Mat &edges, double scale = 1);
+void detect_contours (cv::Mat &edges, const cv::Mat &gray, candidate_table_t &candidates, still_candidates_t *still = NULL);
+void classify_candidates (const candidate_table_t &candidates, arrowvec_t &arrows);
+// classify_candidates is these two: every candidate on its own, then the 
+// whole list sorted into reading order. classify_candidate returns false if
+// it can't tell what kind of arrow the candidate is. sort_arrows 
+// (img_layout.cpp) groups the arrows into lines, which can be slightly
+// skewed, and reads the lines top to bottom and each one left to right.
+bool classify_candidate (const candidate_table_t &candidates, int i, arrow_t &arrow);
+void sort_arrows (arrowvec_t &arrows);
+
+// A picture of what detection saw, half the size of the frame. Not part of 
+// detection itself: whoever shows it draws it, from a result, and only if 
+// it's going to be shown.
+void draw_visualization (const candidate_table_t &candidates, const arrowvec_t &arrows, cv::Mat &visualization);
+
+// Incremental versions of the first two stages (img_changes.cpp). Edges are
+// only computed inside changes.regions, and contours from the unchanged 
+// parts of the frame are carried over from the previous call.
+void detect_changed_edges (const cv::Mat &gray, detect_state_t &state, frame_changes_t &changes, cv::Mat &edges);
+void detect_changed_contours (cv::Mat &edges, const cv::Mat &gray, const frame_changes_t &changes, detect_state_t &state, candidate_table_t &candidates);
+
+// detect_edges cut into horizontal stripes and run on num_threads threads
+// (img_stripes.cpp), with exactly the same result as doing the whole frame
+// at once. detect_edges uses it when detect_config.edge_threads is over 1.
+// Returns false, having done nothing, if gray is too short to be worth 
+// splitting or element isn't one dilate_edges can do.
+bool detect_striped_edges (const cv::Mat &gray, cv::Mat &edges, const cv::Mat &element, int num_threads);
+const double canny_low = 30, canny_high = 60;
+
+// The pieces of Canny and dilate that both of those use (img_edges.cpp),
+// which match OpenCV's output exactly but don't allocate once warmed up.
+// canny_classify marks rows y0 to y1 of map 1 for a candidate edge and 2
+// for a strong one, reading gray two rows either side. canny_seed turns the
+// strong ones in rows y0 to y1 into 255 and stacks them, and canny_follow
+// turns every candidate it can reach from the stack into 255 without
+// leaving rows y0 to y1, adding each one to found if it's given. 
+// canny_edges is all three on the whole of gray.
+// dilate_edges dilates the 255s of map rows src_y0 to src_y1 into rows y0
+// to y1 of out, which can be map; it returns false, having done nothing,
+// unless every row of element is a run centred on the middle column.
+void canny_classify (const cv::Mat &gray, int y0, int y1, cv::Mat &map);
+void canny_seed (cv::Mat &map, int y0, int y1, std::vector<int> &stack);
+void canny_follow (cv::Mat &map, std::vector<int> &stack, int y0, int y1, std::vector<int> *found = NULL);
+void canny_edges (const cv::Mat &gray, cv::Mat &map, std::vector<int> &stack);
+bool dilate_edges (const cv::Mat &map, cv::Mat &out, const cv::Mat &element, int y0, int y1, int src_y0, int src_y1);
+
+// A Mat of the given size over buf's memory, which only gets (re)allocated
+// when it's too small. Unlike a ROI the result has no parent, so filters 
+// can't see past its edges.
+cv::Mat reuse_buffer (cv::Mat &buf, cv::Size size, int type);
+
+// Contour search and filtering for one region of the frame; used by both.
+// Candidates are appended, translated by offset. scale is how big gray is 
+// relative to the full camera frame; the size thresholds follow it. With 
+// detect_config.components this is find_components instead 
+// (img_components.cpp), which labels the blobs in edges in one pass rather
+// than tracing their outlines, and leaves edges alone. Given still, the 
+// outline engine copies the outlines that have settled rather than 
+// measuring them again.
+void find_candidates (cv::Mat &edges, cv::Point offset, const cv::Mat &gray, candidate_table_t &candidates, double scale = 1, 
+                      still_candidates_t *still = NULL);
+void find_components (const cv::Mat &edges, cv::Point offset, const cv::Mat &gray, candidate_table_t &candidates, double scale = 1);
+
+// The outer outlines of the blobs in an image, all in one array: outline i
+// is count[i] points long, starting at points[start[i]]
+typedef struct
+{
+    std::vector<cv::Point> points;
+    std::vector<int> start, count;
+} outline_list_t;
+
+// What find_candidates uses in place of findContours (external outlines,
+// simple chains) and approxPolyDP (closed), giving the same points in the
+// same order without allocating once the vectors have grown
+// (img_outlines.cpp). trace_outlines clobbers edges the way findContours
+// does, and translates the points by offset.
+void trace_outlines (cv::Mat &edges, cv::Point offset, outline_list_t &outlines);
+void simplify_outline (const cv::Point *points, int count, double epsilon, std::vector<cv::Point> &simplified);
+
+// What a candidate has to be, either way: its area within these limits 
+// (in pixels at the calibration resolution), and no brighter than this on
+// average, so patches of glare don't count
+const double min_candidate_area = 800, max_candidate_area = 25600;
+const float max_candidate_darkness = 180;
+
+// Coarse-to-fine versions of the first two stages (img_pyramid.cpp). Edges
+// are found in a copy of the frame shrunk by 2^levels, and each candidate 
+// found there is then re-detected at full size in a small window around it.
+// Used instead of the regular stages when detect_config.pyramid_levels is
+// set (and incremental isn't.)
+void detect_coarse_edges (const cv::Mat &gray, int levels, cv::Mat &small, cv::Mat &edges);
+void detect_refined_contours (cv::Mat &edges, const cv::Mat &small, const cv::Mat &gray, int levels, candidate_table_t &candidates);
+
+// Reduced-resolution versions of the first two stages (img_governor.cpp).
+// Edges are found in a copy of the frame shrunk by scale, with every size
+// threshold scaled to match, and the candidates are scaled back up to 
+// full-frame coordinates.
+void detect_scaled_edges (const cv::Mat &gray, double scale, cv::Mat &small, cv::Mat &edges);
+void detect_scaled_contours (cv::Mat &edges, const cv::Mat &small, double scale, candidate_table_t &candidates);
+
+// Keeps detection within a latency budget by picking the size it runs at 
+// (img_governor.cpp.) Feed it every frame's latency, capture to result; 
+// when the frames have been coming in over budget it steps down to the 
+// next smaller size, and once there's room to spare at the next bigger 
+// size it steps back up. Each step waits for a few frames at the new size
+// first, so it doesn't flap.
+class latency_governor_t
+{
+    double budget_ms; // 0 when off
+    double average_ms; // smoothed, at the current level
+    int level, frames_at_level;
+    
+public:
+    latency_governor_t (void) : budget_ms (0), average_ms (0), level (0), frames_at_level (0) {}
+    
+    void set_budget (double ms);
+    // Returns true if that changed the scale
+    bool update (double latency_ms);
+    double scale (void) const;
+    int get_level (void) const {return level;}
+};
+
+// Image-processing pipeline running on its own threads. The UI thread 
+// submits frames and polls for results; neither call ever blocks. If frames
+// come in faster than they can be processed, the pipeline just skips to the
+// newest one.
+typedef struct
+{
+    int frame_num;
+    timestamp_t capture_time;
+    cv::Mat bgr;
+    cv::Mat gray; // used instead of bgr if set
+    frame_lease_t lease; // for gray
+    double scale; // detect at this size relative to the frame, 1 for full
+} detect_input_t;
+
+typedef struct
+{
+    int frame_num;
+    timestamp_t capture_time;
+    arrowvec_t arrows; // All arrows detected
+    candidate_table_t candidates; // what they were found in
+} detect_result_t;
+
+// A frame's working state as it moves from stage to stage
+typedef struct
+{
+    int frame_num;
+    timestamp_t capture_time;
+    cv::Mat gray, edges;
+    frame_lease_t lease; // for gray, when it's the capture buffer itself
+    cv::Mat small; // shrunk gray, when detecting coarse-to-fine or scaled
+    double scale;
+    frame_changes_t changes;
+    candidate_table_t candidates;
+    arrowvec_t arrows;
+} frame_t;
+
+typedef enum
+{
+    pipeline_serial, // one worker thread runs every stage back to back
+    pipeline_staged  // one thread per stage, several frames in flight
+} pipeline_mode_t;
+
+class detect_pipeline_t
+{
+    // Gray, edges, contours, classify, render
+    static const int num_stages = 5;
+    static const int queue_depth = 2;
+    static const int num_frames = (num_stages - 1) * queue_depth + num_stages + 1;
+    
+    mailbox_t<detect_input_t> input;
+    mailbox_t<detect_result_t> output;
+    std::atomic<bool> quit;
+    std::mutex wake_lock;
+    std::condition_variable wake;
+    
+    frame_t frames[num_frames];
+    bounded_queue_t<frame_t *> free_frames, queues[num_stages - 1];
+    detect_state_t state;
+    std::vector<std::thread> threads;
+    
+    bool next_input (void);
+    void begin_frame (frame_t *frame);
+    void find_edges (frame_t *frame);
+    void find_contours (frame_t *frame);
+    void classify (frame_t *frame);
+    void finish_frame (frame_t *frame);
+    void release_capture (frame_t *frame);
+    void run_serial (void);
+    void run_gray (void);
+    void run_stage (int stage);
+    void run_render (void);
+    
+public:
+    void start (pipeline_mode_t mode);
+    void stop (void);
+    
+    // Fill in input_slot (), then submit () it.
+    detect_input_t &input_slot (void) {return input.write_slot ();}
+    void submit (void);
+    
+    // True once the last frame submitted has been picked up, so that one 
+    // submitted now is sure to be processed instead of replaced. Frames the
+    // pipeline doesn't want don't need to be decoded at all.
+    bool wants_input (void) const {return !input.pending ();}
+    
+    // Returns the newest result if there's one we haven't seen yet, or NULL.
+    // The result stays valid until the next call.
+    detect_result_t *poll (void);
+};
+
+// Frame sources: a live camera, a video file, a directory of stills, or a
+// synthetic worksheet generator for running without any hardware.
+class frame_source_t
+{
+protected:
+    cv::Mat grabbed; // for the default grab and retrieve
+    
+public:
+    virtual ~frame_source_t (void) {}
+    
+    // Returns false at end of stream. The frame is BGR and, like 
+    // cvQueryFrame, only valid until the next call.
+    virtual bool getframe (cv::Mat &out) = 0;
+    
+    // Capture in two steps, like cvGrabFrame and cvRetrieveFrame. grab 
+    // takes the next frame off the source as cheaply as it can (and for a 
+    // live camera, skips past any it has queued up, so the frame is as 
+    // fresh as possible) and returns false at end of stream. Only a frame 
+    // that's actually needed then gets decoded by one of the retrieves, 
+    // which can be called any number of times per grab, except that 
+    // retrieve_luma may give the frame away and so has to come last. The 
+    // defaults just do all the work in grab, with getframe.
+    virtual bool grab (void) {return getframe (grabbed);}
+    virtual bool retrieve (cv::Mat &out);
+    virtual bool retrieve_luma (cv::Mat &gray, frame_lease_t &lease);
+    
+    // The grabbed frame shrunk to fit out, in BGR, by the cheapest means 
+    // the source has; for showing, not for detection. Luma sources give a
+    // gray picture. Sources with no cheap means may leave out as it was 
+    // (an earlier frame) unless the frame has already been retrieved, so 
+    // it's best called after any retrieve but before retrieve_luma.
+    virtual void retrieve_preview (cv::Mat &out);
+    
+    // Brightness only, for detection. gray is always a new header, never
+    // written over in place, and for sources with has_luma () it points 
+    // straight into the captured buffer, which stays put until lease is 
+    // dropped. The default is grab and then retrieve_luma, which unless 
+    // overridden just converts retrieve's output.
+    virtual bool getluma (cv::Mat &gray, frame_lease_t &lease);
+    
+    // True if getluma doesn't need a colour decode and conversion
+    virtual bool has_luma (void) {return false;}
+    
+    // Frames per second the source is meant to be played back at, or 0 if
+    // unknown.
+    virtual double native_fps (void) {return 0;}
+    
+    // Size of the frames to come, without using any of them up, or 0x0 if
+    // it can't be told in advance
+    virtual cv::Size frame_size (void) {return cv::Size ();}
+};
+
+// spec is cam[:N], video:PATH, dir:PATH, synth[:FRAMES], v4l2[:DEVICE], 
+// y4m:PATH or yuv:WxH:PATH
+frame_source_t *open_frame_source (const char *spec); // NULL on failure
+
+// Makes the capture size whatever source's frames actually are (a camera 
+// may not offer the size asked for, and files have one of their own), 
+// saying so if that's a change. Call it before any detection starts.
+void fit_capture_size (frame_source_t *source);
+
+// Appends the images in a directory to paths, sorted by name. Returns 
+// false after printing why if the directory can't be read.
+bool list_images (const std::string &dir, std::vector<std::string> &paths);
+bool has_image_extension (const std::string &name);
+
+// Luma capture straight from the driver's or the file's buffers 
+// (img_luma.cpp). Both return NULL after printing why on failure.
+frame_source_t *open_v4l2_source (const char *device);
+frame_source_t *open_y4m_source (const char *path);
+frame_source_t *open_yuv_source (const char *path, int width, int height); // raw I420
+
+// Offline grading (batch.cpp): detects the arrows on every image in inputs
+// (each a directory, an image, or a file listing images one per line) on 
+// num_threads threads, 0 for one per core, traces them through the maze 
+// made from seed, and prints a JSON line per image, in input order. 
+// Returns the exit status.
+int run_batch (const std::vector<std::string> &inputs, uint64_t seed, int maze_side, int num_threads);
+
+// One station of several run from the same process (session.cpp): a frame
+// source with a maze, trace and detection state all of its own
+class session_t
+{
+public:
+    int id;
+    frame_source_t *source; // deleted along with the session
+    int maze_side;
+    uint64_t next_seed; // for the next maze
+    maze_state_t *maze_state;
+    mazepublic_t maze, trace;
+    maze_progress_t progress;
+    detect_state_t detect;
+    arrowvec_t arrows;
+    cv::Mat frame, gray;
+    frame_lease_t lease;
+    int frames, solved;
+    
+    session_t (int id, frame_source_t *source, int maze_side, uint64_t seed);
+    ~session_t (void);
+    
+    // Captures a frame, finds its arrows and traces them, starting a new 
+    // maze if that solves this one. Returns false at end of stream.
+    bool step (void);
+    void new_maze (void);
+};
+
+// Runs any number of sessions a frame at a time on a shared pool of 
+// threads, each session on only one thread at a time
+class session_scheduler_t
+{
+    std::vector<session_t *> sessions;
+    
+public:
+    ~session_scheduler_t (void);
+    
+    // Takes over source
+    void add (frame_source_t *source, int maze_side, uint64_t seed);
+    int size (void) const {return (int)sessions.size ();}
+    const session_t *get (int i) const {return sessions[i];}
+    
+    // Returns once every session's source has ended, or it has done 
+    // max_frames (if not 0.) num_threads 0 means one per core.
+    void run (int num_threads, int max_frames);
+};
+
+// Headless, one session per frame source spec, then a summary of each and
+// the frame rate of them all together. Returns the exit status.
+int run_sessions (const std::vector<std::string> &specs, bool seeded, uint64_t seed, int maze_side, int num_threads, int max_frames);
 #endif
@@ -23,27 +23,128 @@ THE SOFTWARE.
 */
 
 // This is an implementation of the unmodified randomized Prim's algorithm from
-// http://en.wikipedia.org/wiki/Maze_generation_algorithm
+// http://en.wikipedia.org/wiki/Maze_generation_algorithm (and of Eller's 
+// algorithm, further down, for when the maze is too big to keep around.)
+//
+// Walls are numbered so that wall 2*n is the one on the right of cell n and
+// wall 2*n+1 the one below it. A wall only goes into the wall list when it's
+// first seen from a visited cell with an unvisited cell on the other side, 
+// so nothing is ever added twice. It can still turn out to have visited 
+// cells on both sides by the time it's picked, in which case it's just 
+// dropped, exactly as before; the choice among the walls that are still 
+// live stays uniform.
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <assert.h>
 #include <time.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "mazedemo_common.h"
 
 typedef unsigned char byte;
 
+static inline int min (int a, int b)
+{
+    return a < b ? a : b;
+}
+
+static inline int max (int a, int b)
+{
+    return a > b ? a : b;
+}
+
 
 typedef struct
 {
     int width, height, area;
     int num_wall_list;
-    byte *mark_cells, *mark_passages, *in_wall_list;
-    int *wall_list;
+    byte *mark_cells, *mark_passages;
+    uint32_t *wall_list;
+    // Distance to the goal, see compute_distances. Only worked out the 
+    // first time the maze is traced, so NULL until then.
+    byte *mark_dist;
+    int start_dist;
+    int tile_size; // the one the tiled engine built it with, 0 otherwise
 } maze_t;
 
+// xoshiro256** seeded through splitmix64, from http://prng.di.unimi.it/. 
+// Fast, good enough for anything we'd use it for, and unlike rand () it
+// gives the same sequence everywhere.
+typedef struct
+{
+    uint64_t s[4];
+    uint64_t bits; // left over for rng_coin
+    int num_bits;
+} maze_rng_t;
+
+static inline uint64_t rotl (uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+static void rng_seed (maze_rng_t *rng, uint64_t seed)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        rng->s[i] = z ^ (z >> 31);
+    }
+    rng->num_bits = 0;
+}
+
+static inline uint64_t rng_next (maze_rng_t *rng)
+{
+    uint64_t *s = rng->s;
+    uint64_t result = rotl (s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl (s[3], 45);
+    return result;
+}
+
+// Uniform in [0, range) without a division, using Lemire's multiply-and-
+// shift method (https://arxiv.org/abs/1805.10941). The rejection step that
+// makes it exactly uniform almost never runs.
+static inline uint32_t rng_below (maze_rng_t *rng, uint32_t range)
+{
+    uint64_t m = (rng_next (rng) >> 32) * range;
+    uint32_t low = (uint32_t)m;
+    if (low < range)
+    {
+        uint32_t threshold = -range % range;
+        while (low < threshold)
+        {
+            m = (rng_next (rng) >> 32) * range;
+            low = (uint32_t)m;
+        }
+    }
+    return m >> 32;
+}
+
+// One random bit, 64 of them per call to rng_next
+static inline bool rng_coin (maze_rng_t *rng)
+{
+    if (!rng->num_bits)
+    {
+        rng->bits = rng_next (rng);
+        rng->num_bits = 64;
+    }
+    rng->num_bits--;
+    bool ret = rng->bits & 1;
+    rng->bits >>= 1;
+    return ret;
+}
+
 static inline bool get_bitmask (const byte *mask, int entry)
 {
     return (mask[entry>>3] & (1<<(entry&7))) != 0;
@@ -61,9 +162,7 @@ static inline void set_bitmask (byte *mask, int entry)
 
 static byte *make_bitmask (int size)
 {
-    byte *ret = malloc ((size>>3) + 1);
-    memset (ret, 0, (size>>3) + 1);
-    return ret;
+    return calloc ((size>>3) + 1, 1);
 }
 
 static void initialize_maze (maze_t *out, int width, int height)
@@ -71,226 +170,1121 @@ static void initialize_maze (maze_t *out, int width, int height)
     out->width = width;
     out->height = height;
     out->area = width * height;
+    out->mark_passages = make_bitmask (2 * out->area);
+}
+
+static inline void add_wall_to_list (maze_t *maze, int wall_num, int other_cell)
+{
+    if (!get_bitmask (maze->mark_cells, other_cell))
+        maze->wall_list[maze->num_wall_list++] = wall_num;
+}
+
+static void visit_cell (maze_t *maze, int cell_num)
+{
+    int col = cell_num % maze->width;
+    set_bitmask (maze->mark_cells, cell_num);
+    if (col > 0)
+        add_wall_to_list (maze, 2 * cell_num - 2, cell_num - 1);
+    if (col < maze->width - 1)
+        add_wall_to_list (maze, 2 * cell_num, cell_num + 1);
+    if (cell_num >= maze->width)
+        add_wall_to_list (maze, 2 * (cell_num - maze->width) + 1, cell_num - maze->width);
+    if (cell_num + maze->width < maze->area)
+        add_wall_to_list (maze, 2 * cell_num + 1, cell_num + maze->width);
+}
+
+static void handle_wall (maze_t *maze, int wall_list_num)
+{
+    int wall_num = maze->wall_list[wall_list_num];
     
-    int npassages = 2 * out->area;
+    // Whichever wall it is, it comes out of the list
+    maze->wall_list[wall_list_num] = maze->wall_list[--maze->num_wall_list];
     
-    out->mark_cells = make_bitmask (out->area);
-    out->mark_passages = make_bitmask (npassages);
-    out->in_wall_list = make_bitmask (npassages);
+    // Right wall: the other side is the next cell over. Bottom wall: the 
+    // next cell down.
+    int cell1_num = wall_num >> 1;
+    int cell2_num = cell1_num + 1 + (wall_num & 1) * (maze->width - 1);
     
-    out->num_wall_list = 0;
-    out->wall_list = malloc (sizeof(int) * npassages);
+    bool cell1_visited = get_bitmask (maze->mark_cells, cell1_num);
+    bool cell2_visited = get_bitmask (maze->mark_cells, cell2_num);
+    assert (cell1_visited || cell2_visited);
+    
+    if (cell1_visited && cell2_visited)
+        return;
+    
+    set_bitmask (maze->mark_passages, wall_num);
+    visit_cell (maze, cell1_visited ? cell2_num : cell1_num);
 }
 
-static int wall_num_between_cells (const maze_t *maze, int cell1_num, int cell2_num)
+#define outline (out->lines[out->numlines])
+
+#define ADD_VERTLINE(x,y1,y2) \
+{ \
+    outline[0][0] = outline[1][0] = x; \
+    outline[0][1] = y1; \
+    outline[1][1] = y2; \
+    out->numlines++; \
+}
+
+#define ADD_HORIZLINE(y,x1,x2) \
+{ \
+    outline[0][1] = outline[1][1] = y; \
+    outline[0][0] = x1; \
+    outline[1][0] = x2; \
+    out->numlines++; \
+}
+
+// A maze's lines are the outer borders, then the walls of each row from top
+// to bottom, then the goal square. These add each part to out, which has to
+// have room.
+static void add_border_lines (mazepublic_t *out, int width, int height)
 {
-    if (cell2_num < cell1_num)
-        return wall_num_between_cells (maze, cell2_num, cell1_num);
+    ADD_HORIZLINE (0, 4, 4*width); // upper border
+    ADD_VERTLINE (0, 0, 4*height); // left border
+    ADD_HORIZLINE (4*height, 0, 4*width - 4); //lower border
+}
+
+// Walls that carry on in a straight line are drawn as one line. Along a 
+// row that's easy; down the columns, each column remembers the row its 
+// current run of walls started in (or -1), and the run is drawn once it 
+// ends. Runs are also cut off every run_break_rows rows, so that bands of
+// rows can be drawn separately (in parallel) and still come out exactly 
+// the same as when drawn in one go.
+static const int run_break_rows = 256;
 
-    int ret = 2 * cell1_num;    
-    if (cell2_num == cell1_num + 1 && cell2_num % maze->width != 0)
-        return ret;
-    else if (cell2_num == cell1_num + maze->width)
-        return ret + 1;
-    else 
-        assert (false);
+// With no out->lines, only counts
+static inline void emit_line (mazepublic_t *out, int x1, int y1, int x2, int y2)
+{
+    if (out->lines)
+    {
+        outline[0][0] = x1;
+        outline[0][1] = y1;
+        outline[1][0] = x2;
+        outline[1][1] = y2;
+    }
+    out->numlines++;
 }
 
-static int add_wall_to_list (maze_t *maze, int wall_num, int avoid_wall_num)
+static void end_wall_runs (mazepublic_t *out, int *run_start, int row, int width)
 {
-    if (wall_num != avoid_wall_num && !get_bitmask (maze->in_wall_list, wall_num))
+    for (int col = 0; col < width; col++)
     {
-        assert (!get_bitmask (maze->mark_passages, wall_num));
-        set_bitmask (maze->in_wall_list, wall_num);
-        maze->wall_list[maze->num_wall_list++] = wall_num;
+        if (run_start[col] >= 0)
+        {
+            emit_line (out, 4*col + 4, 4*run_start[col], 4*col + 4, 4*row);
+            run_start[col] = -1;
+        }
     }
 }
 
-static int visit_cell (maze_t *maze, int cell_num, int from_wall)
+// passages holds the row's walls, numbered from first_wall on. run_start
+// is the per-column state above, width entries that start out as -1.
+static void add_row_lines (mazepublic_t *out, int *run_start, const byte *passages, int first_wall, int row, int width, int height)
 {
-    set_bitmask (maze->mark_cells, cell_num);
-    if (cell_num % maze->width)
-        add_wall_to_list (maze, wall_num_between_cells (maze, cell_num, cell_num-1), from_wall);
-    if ((cell_num + 1) % maze->width)
-        add_wall_to_list (maze, wall_num_between_cells (maze, cell_num, cell_num+1), from_wall);
-    if (cell_num >= maze->width)
-        add_wall_to_list (maze, wall_num_between_cells (maze, cell_num, cell_num-maze->width), from_wall);
-    if ((cell_num + maze->width) < maze->area)
-        add_wall_to_list (maze, wall_num_between_cells (maze, cell_num, cell_num+maze->width), from_wall);
+    int hrun_start = -1;
+    for (int col = 0, wall = first_wall; col < width; col++, wall += 2)
+    {
+        bool below = !get_bitmask (passages, wall+1) && row < height - 1;
+        if (below && hrun_start < 0)
+            hrun_start = col;
+        else if (!below && hrun_start >= 0)
+        {
+            emit_line (out, 4*hrun_start, 4*row + 4, 4*col, 4*row + 4);
+            hrun_start = -1;
+        }
+        
+        bool right = !get_bitmask (passages, wall);
+        if (right && run_start[col] < 0)
+            run_start[col] = row;
+        else if (!right && run_start[col] >= 0)
+        {
+            emit_line (out, 4*col + 4, 4*run_start[col], 4*col + 4, 4*row);
+            run_start[col] = -1;
+        }
+    }
+    if (hrun_start >= 0)
+        emit_line (out, 4*hrun_start, 4*row + 4, 4*width, 4*row + 4);
+    
+    if (row == height - 1 || (row + 1) % run_break_rows == 0)
+        end_wall_runs (out, run_start, row + 1, width);
 }
 
-static void handle_wall (maze_t *maze, int wall_list_num)
+static int *make_run_starts (int width)
+{
+    int *run_start = malloc (sizeof(*run_start) * width);
+    memset (run_start, 0xff, sizeof(*run_start) * width);
+    return run_start;
+}
+
+static void add_goal_lines (mazepublic_t *out, int width, int height)
+{
+    // Draw a small square indicating the goal point
+    ADD_HORIZLINE (4*height - 3, 4*width - 3, 4*width - 1);
+    ADD_HORIZLINE (4*height - 1, 4*width - 3, 4*width - 1);
+    ADD_VERTLINE (4*width - 3, 4*height - 3, 4*height - 1);
+    ADD_VERTLINE (4*width - 1, 4*height - 3, 4*height - 1);
+}
+
+// Runs fn (ctx, task) for every task from 0 to num_tasks-1, on up to 
+// num_threads threads (this one included) that each take the next task as
+// they come free
+typedef void (*task_fn_t) (void *ctx, int task);
+
+typedef struct
 {
-    int wall_num;
-    int cell1_num, cell2_num;
+    task_fn_t fn;
+    void *ctx;
+    int num_tasks, next_task;
+} task_pool_t;
+
+static void *pool_thread (void *arg)
+{
+    task_pool_t *pool = arg;
+    int task;
+    while ((task = __atomic_fetch_add (&pool->next_task, 1, __ATOMIC_RELAXED)) < pool->num_tasks)
+        pool->fn (pool->ctx, task);
+    return NULL;
+}
+
+static void run_parallel (int num_tasks, int num_threads, task_fn_t fn, void *ctx)
+{
+    task_pool_t pool = {fn, ctx, num_tasks, 0};
+    if (num_threads > num_tasks)
+        num_threads = num_tasks;
+    if (num_threads < 1)
+        num_threads = 1;
+    
+    pthread_t threads[num_threads];
+    int started = 0;
+    for (int i = 1; i < num_threads; i++)
+    {
+        if (pthread_create (&threads[started], NULL, pool_thread, &pool) == 0)
+            started++;
+    }
+    pool_thread (&pool);
+    for (int i = 0; i < started; i++)
+        pthread_join (threads[i], NULL);
+}
+
+static int tile_size = 256, maze_threads = 0;
+
+void set_maze_tiling (int new_tile_size, int num_threads)
+{
+    tile_size = new_tile_size > 1 ? new_tile_size : 2;
+    maze_threads = num_threads;
+}
+
+static int num_maze_threads (void)
+{
+    if (maze_threads > 0)
+        return maze_threads;
+    long cores = sysconf (_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? cores : 1;
+}
+
+// Big mazes get their lines written by bands of rows in parallel: each 
+// band counts its lines first, so it knows where in the array to start,
+// and the order comes out the same as when done in one go.
+static const int parallel_lines_area = 1 << 20;
+
+typedef struct
+{
+    const maze_t *maze;
+    mazepublic_t *out;
+    int band_rows;
+    int *band_start;
+} lines_job_t;
+
+// With job->out->lines NULL, only counts
+static int add_band_lines (const lines_job_t *job, mazepublic_t *band_out, int band)
+{
+    const maze_t *maze = job->maze;
+    int *run_start = make_run_starts (maze->width);
+    int end_row = min (maze->height, (band + 1) * job->band_rows);
+    for (int row = band * job->band_rows; row < end_row; row++)
+        add_row_lines (band_out, run_start, maze->mark_passages, 2 * row * maze->width, row, maze->width, maze->height);
+    free (run_start);
+    return band_out->numlines;
+}
+
+static void count_band_lines (void *ctx, int band)
+{
+    lines_job_t *job = ctx;
+    mazepublic_t band_out = {0, NULL};
+    job->band_start[band + 1] = add_band_lines (job, &band_out, band);
+}
+
+static void fill_band_lines (void *ctx, int band)
+{
+    lines_job_t *job = ctx;
+    mazepublic_t band_out;
+    band_out.lines = job->out->lines + job->out->numlines + job->band_start[band];
+    band_out.numlines = 0;
+    add_band_lines (job, &band_out, band);
+}
+
+static void add_lines_parallel (const maze_t *maze, mazepublic_t *out)
+{
+    int threads = num_maze_threads ();
+    lines_job_t job;
+    job.maze = maze;
+    job.out = out;
+    // A few bands per thread so an unlucky one doesn't hold everyone up,
+    // each a whole number of wall run breaks
+    job.band_rows = (maze->height + 4 * threads - 1) / (4 * threads);
+    job.band_rows = (job.band_rows + run_break_rows - 1) / run_break_rows * run_break_rows;
+    int num_bands = (maze->height + job.band_rows - 1) / job.band_rows;
+    job.band_start = malloc (sizeof(*job.band_start) * (num_bands + 1));
+    job.band_start[0] = 0;
     
-    wall_num = maze->wall_list[wall_list_num];
+    run_parallel (num_bands, threads, count_band_lines, &job);
+    for (int band = 0; band < num_bands; band++)
+        job.band_start[band + 1] += job.band_start[band];
+    run_parallel (num_bands, threads, fill_band_lines, &job);
     
-    cell1_num = wall_num/2;
+    out->numlines += job.band_start[num_bands];
+    free (job.band_start);
+}
+
+// Where a trace is after each arrow. Between frames the arrow list mostly
+// stays the same apart from the last few, so maze_trace keeps this around
+// and only walks the arrows from the first one that changed. The trace's 
+// lines live here as well: everything up to the changed arrow is already 
+// drawn.
+typedef struct
+{
+    mazepoint_t point;
+    int dist, first_wrong;
+    int numlines; // path segments drawn so far
+} trace_step_t;
+
+typedef struct
+{
+    int num_steps, capacity;
+    byte *dirs; // arrowdir_t of each arrow walked
+    trace_step_t *steps;
+    mazeline_t *lines;
+} trace_cache_t;
+
+// A maze and everything kept around for it between calls. Nothing in here
+// is shared with any other maze_state_t, so each can be used from its own
+// thread. The functions without a state all use default_state.
+struct maze_state
+{
+    maze_t maze;
+    // Kept from one maze to the next, so a new maze no bigger than the last
+    // one doesn't allocate
+    mazeline_t *lines_buffer;
+    size_t lines_capacity;
+    trace_cache_t trace_cache;
+};
+
+static maze_state_t default_state;
+
+static void generate_maze_lines (maze_state_t *state, mazepublic_t *out)
+{
+    const maze_t *maze = &state->maze;
+    size_t num_lines = (size_t)(maze->width + 1) * (maze->height + 1) + 8;
+    if (num_lines > state->lines_capacity)
+    {
+        free (state->lines_buffer);
+        state->lines_buffer = malloc (sizeof(*state->lines_buffer) * num_lines);
+        state->lines_capacity = num_lines;
+    }
+    out->lines = state->lines_buffer;
+    out->numlines = 0;
     
-    if (wall_num % 2)
-        cell2_num = cell1_num + maze->width;
+    add_border_lines (out, maze->width, maze->height);
+    if (maze->area >= parallel_lines_area && num_maze_threads () > 1)
+        add_lines_parallel (maze, out);
     else
-        cell2_num = cell1_num + 1;
+    {
+        int *run_start = make_run_starts (maze->width);
+        for (int row = 0; row < maze->height; row++)
+            add_row_lines (out, run_start, maze->mark_passages, 2 * row * maze->width, row, maze->width, maze->height);
+        free (run_start);
+    }
+    add_goal_lines (out, maze->width, maze->height);
+}
+
+// Eller's algorithm, from http://www.neocomputer.org/projects/eller.html.
+// The maze is built a row at a time, remembering only which cells of the
+// current row are already connected to each other through the rows above 
+// (their "set"), so it needs O(width) memory however tall the maze is. 
+// Neighbours in different sets are joined at random, then every set gets 
+// at least one random passage down so nothing is cut off; the last row 
+// joins everything that's left. Each finished row is handed to row_fn, 
+// with its walls numbered the same way as in mark_passages but starting 
+// from 0.
+typedef void (*maze_row_fn_t) (void *ctx, int row, const byte *passages);
+
+static inline int find_set (int *parent, int label)
+{
+    while (parent[label] != label)
+        label = parent[label] = parent[parent[label]];
+    return label;
+}
+
+static void eller_rows (int width, int height, uint64_t seed, maze_row_fn_t row_fn, void *ctx)
+{
+    maze_rng_t rng;
+    rng_seed (&rng, seed);
     
-    bool cell1_visited = get_bitmask (maze->mark_cells, cell1_num);
-    bool cell2_visited = get_bitmask (maze->mark_cells, cell2_num);
+    int *set = malloc (sizeof(int) * width); // each cell's set label
+    int *parent = malloc (sizeof(int) * width); // labels that were merged
+    int *members = malloc (sizeof(int) * width); // per set, cells seen so far
+    int *chosen = malloc (sizeof(int) * width); // per set, which member goes down
+    int *relabel = malloc (sizeof(int) * width);
+    byte *has_down = malloc (width);
+    byte *passages = make_bitmask (2 * width);
+    
+    for (int col = 0; col < width; col++)
+        set[col] = parent[col] = col;
+    
+    for (int row = 0; row < height; row++)
+    {
+        bool last = row == height - 1;
+        memset (passages, 0, ((2 * width)>>3) + 1);
+        
+        for (int col = 0; col < width - 1; col++)
+        {
+            int a = find_set (parent, set[col]), b = find_set (parent, set[col+1]);
+            if (a != b && (last || rng_coin (&rng)))
+            {
+                parent[b] = a;
+                set_bitmask (passages, 2*col);
+            }
+        }
+        
+        if (!last)
+        {
+            for (int col = 0; col < width; col++)
+            {
+                int s = set[col] = find_set (parent, set[col]);
+                members[s] = 0;
+                has_down[s] = false;
+            }
+            
+            // Random passages down. Coin flips can't be predicted, so no
+            // branching on them.
+            for (int col = 0; col < width; col++)
+            {
+                int s = set[col];
+                int down = rng_coin (&rng);
+                members[s]++;
+                passages[(2*col + 1)>>3] |= down << ((2*col + 1)&7);
+                has_down[s] |= down;
+            }
+            
+            // A set that didn't get one gets one from a random member. 
+            // chosen counts down the members still to go before it.
+            for (int col = 0; col < width; col++)
+            {
+                int s = set[col];
+                if (has_down[s])
+                    continue;
+                if (members[s] > 0)
+                {
+                    chosen[s] = rng_below (&rng, members[s]);
+                    members[s] = 0;
+                }
+                if (chosen[s]-- == 0)
+                {
+                    set_bitmask (passages, 2*col + 1);
+                    has_down[s] = true;
+                }
+            }
+            
+            // Cells below a passage stay in the set they came from, the rest
+            // start out on their own. Labels are packed back into 0..width-1.
+            for (int col = 0; col < width; col++)
+                relabel[col] = -1;
+            int num_labels = 0;
+            for (int col = 0; col < width; col++)
+            {
+                int s = set[col];
+                if (!get_bitmask (passages, 2*col + 1))
+                    set[col] = num_labels++;
+                else if (relabel[s] < 0)
+                    set[col] = relabel[s] = num_labels++;
+                else
+                    set[col] = relabel[s];
+                parent[col] = col;
+            }
+        }
+        
+        row_fn (ctx, row, passages);
+    }
     
-    if (cell1_visited && !cell2_visited)
+    free (set);
+    free (parent);
+    free (members);
+    free (chosen);
+    free (relabel);
+    free (has_down);
+    free (passages);
+}
+
+// The neighbour in the given direction, or -1 if there's a wall (or the 
+// edge of the maze) in the way
+static inline int open_neighbour (const maze_t *m, int cell_num, arrowdir_t dir)
+{
+    int col = cell_num % m->width;
+    switch (dir)
+    {
+        case arrow_right:
+            if (col == m->width - 1 || !get_bitmask (m->mark_passages, 2 * cell_num))
+                return -1;
+            return cell_num + 1;
+        case arrow_left:
+            if (col == 0 || !get_bitmask (m->mark_passages, 2 * cell_num - 2))
+                return -1;
+            return cell_num - 1;
+        case arrow_down:
+            if (cell_num + m->width >= m->area || !get_bitmask (m->mark_passages, 2 * cell_num + 1))
+                return -1;
+            return cell_num + m->width;
+        default:
+            if (cell_num < m->width || !get_bitmask (m->mark_passages, 2 * (cell_num - m->width) + 1))
+                return -1;
+            return cell_num - m->width;
+    }
+}
+
+// Every cell's distance from the goal, along the one path there is, only
+// kept mod 3 in two bits per cell (3 meaning not reached yet.) One step 
+// always changes the distance by exactly one, and mod 3 is still enough to
+// tell closer from further, so together with the start's real distance 
+// that gives the distance of anywhere a trace can get to, and the way on
+// from there, without any searching while playing.
+static inline int get_dist3 (const byte *dist, int cell_num)
+{
+    return (dist[cell_num>>2] >> (2*(cell_num&3))) & 3;
+}
+
+static inline void set_dist3 (byte *dist, int cell_num, int value)
+{
+    int shift = 2*(cell_num&3);
+    dist[cell_num>>2] = (dist[cell_num>>2] & ~(3<<shift)) | value<<shift;
+}
+
+// The way from a cell to the one next to it that's one step closer to the
+// goal. Only the goal itself has none, and gets -1.
+static int dir_towards_goal (const maze_t *m, int cell_num)
+{
+    int closer = (get_dist3 (m->mark_dist, cell_num) + 2) % 3;
+    for (int dir = arrow_up; dir <= arrow_left; dir++)
     {
-        set_bitmask (maze->mark_passages, wall_num);
-        visit_cell (maze, cell2_num, wall_num);
+        int next = open_neighbour (m, cell_num, dir);
+        if (next >= 0 && get_dist3 (m->mark_dist, next) == closer)
+            return dir;
     }
-    else if (!cell1_visited && cell2_visited)
+    return -1;
+}
+
+// Breadth first from the goal, then walks the path from the start to count
+// its length. The queue is a ring buffer that grows when it fills up; in a
+// perfect maze the frontier stays much smaller than the maze.
+static void bfs_distances (maze_t *m)
+{
+    m->mark_dist = malloc ((m->area>>2) + 1);
+    memset (m->mark_dist, 0xff, (m->area>>2) + 1);
+    
+    uint32_t capacity = 1024, head = 0, tail = 0;
+    uint32_t *queue = malloc (sizeof(*queue) * capacity);
+    set_dist3 (m->mark_dist, m->area - 1, 0);
+    queue[tail++] = m->area - 1;
+    
+    while (head != tail)
     {
-        set_bitmask (maze->mark_passages, wall_num);
-        visit_cell (maze, cell1_num, wall_num);
+        int cell_num = queue[head++ & (capacity - 1)];
+        int next_dist = (get_dist3 (m->mark_dist, cell_num) + 1) % 3;
+        for (int dir = arrow_up; dir <= arrow_left; dir++)
+        {
+            int next = open_neighbour (m, cell_num, dir);
+            if (next < 0 || get_dist3 (m->mark_dist, next) != 3)
+                continue;
+            set_dist3 (m->mark_dist, next, next_dist);
+            if (tail - head == capacity)
+            {
+                // Unwrap into a buffer twice the size
+                uint32_t *bigger = malloc (sizeof(*bigger) * capacity * 2);
+                for (uint32_t i = 0; i < capacity; i++)
+                    bigger[i] = queue[(head + i) & (capacity - 1)];
+                free (queue);
+                queue = bigger;
+                head = 0;
+                tail = capacity;
+                capacity *= 2;
+            }
+            queue[tail++ & (capacity - 1)] = next;
+        }
     }
-    else if (cell1_visited && cell2_visited)
+    free (queue);
+    
+    m->start_dist = 0;
+    for (int cell_num = 0; cell_num != m->area - 1; m->start_dist++)
+        cell_num = open_neighbour (m, cell_num, dir_towards_goal (m, cell_num));
+}
+
+// A tiled maze's tiles only meet through the one passage on each edge of 
+// the tile tree, so the way to the goal from anywhere in a tile leaves it 
+// through the passage towards the goal's tile (its exit), and a cell's 
+// distance is how far it is from the exit inside the tile plus the exit's 
+// own. So every tile is searched on its own, in parallel and in cache, the
+// exits' distances are added up along the tile tree, and then each tile 
+// goes into mark_dist with its exit's distance added on.
+typedef struct
+{
+    int parent; // the next tile towards the goal's, -1 for that one
+    int exit, entry; // the cells either side of the passage to the parent
+    int entry_dist; // entry's distance from the parent's exit
+    int offset; // exit's distance from the goal
+} dist_tile_t;
+
+typedef struct
+{
+    maze_t *maze;
+    int tiles_x, tiles_y, tile_size;
+    dist_tile_t *tiles;
+    byte *local; // each tile's distances from its exit, mod 3
+    size_t local_bytes; // per tile
+    int start_local; // the start's distance from its tile's exit
+} dist_tiling_t;
+
+static void dist_tile_bounds (const dist_tiling_t *d, int tile, int *x0, int *y0, int *w, int *h)
+{
+    *x0 = (tile % d->tiles_x) * d->tile_size;
+    *y0 = (tile / d->tiles_x) * d->tile_size;
+    *w = min (d->tile_size, d->maze->width - *x0);
+    *h = min (d->tile_size, d->maze->height - *y0);
+}
+
+static void search_dist_tile (void *ctx, int tile)
+{
+    dist_tiling_t *d = ctx;
+    const maze_t *m = d->maze;
+    int x0, y0, w, h;
+    dist_tile_bounds (d, tile, &x0, &y0, &w, &h);
+    
+    // Everything in here is numbered within the tile
+    int *dist = malloc (sizeof(*dist) * w * h);
+    int *queue = malloc (sizeof(*queue) * w * h);
+    for (int i = 0; i < w * h; i++)
+        dist[i] = -1;
+    byte *local = d->local + tile * d->local_bytes;
+    #define LOCAL_CELL(cell_num) (((cell_num) / m->width - y0) * w + (cell_num) % m->width - x0)
+    
+    int head = 0, tail = 0;
+    queue[tail++] = LOCAL_CELL (d->tiles[tile].exit);
+    dist[queue[0]] = 0;
+    while (head != tail)
     {
-        clear_bitmask (maze->in_wall_list, wall_num);
-        maze->num_wall_list--;
-        if (wall_list_num != maze->num_wall_list)
-            maze->wall_list[wall_list_num] = maze->wall_list[maze->num_wall_list];
+        int here = queue[head++];
+        int x = here % w, y = here / w, cell_num = (y0 + y) * m->width + x0 + x;
+        set_dist3 (local, here, dist[here] % 3);
+        
+        int next[4] = {-1, -1, -1, -1};
+        if (x < w - 1 && get_bitmask (m->mark_passages, 2 * cell_num))
+            next[0] = here + 1;
+        if (x > 0 && get_bitmask (m->mark_passages, 2 * cell_num - 2))
+            next[1] = here - 1;
+        if (y < h - 1 && get_bitmask (m->mark_passages, 2 * cell_num + 1))
+            next[2] = here + w;
+        if (y > 0 && get_bitmask (m->mark_passages, 2 * (cell_num - m->width) + 1))
+            next[3] = here - w;
+        for (int i = 0; i < 4; i++)
+        {
+            if (next[i] >= 0 && dist[next[i]] < 0)
+            {
+                dist[next[i]] = dist[here] + 1;
+                queue[tail++] = next[i];
+            }
+        }
     }
-    else
+    
+    // The tiles hanging off this one come in through cells in it
+    int neighbours[4] = {tile - d->tiles_x, tile + d->tiles_x, -1, -1};
+    if (tile % d->tiles_x > 0)
+        neighbours[2] = tile - 1;
+    if (tile % d->tiles_x < d->tiles_x - 1)
+        neighbours[3] = tile + 1;
+    for (int i = 0; i < 4; i++)
     {
-        assert (false);
+        int n = neighbours[i];
+        if (n >= 0 && n < d->tiles_x * d->tiles_y && d->tiles[n].parent == tile)
+            d->tiles[n].entry_dist = dist[LOCAL_CELL (d->tiles[n].entry)];
     }
+    if (tile == 0)
+        d->start_local = dist[0];
+    #undef LOCAL_CELL
+    
+    free (dist);
+    free (queue);
 }
 
-static void generate_maze_lines (const maze_t *maze, mazepublic_t *out)
+// Tiles side by side can share a byte of mark_dist, so this goes in a byte
+// at a time with an atomic OR, the same as generate_tile
+static void merge_dist_tile (void *ctx, int tile)
 {
-    int row, col, cell;
+    const dist_tiling_t *d = ctx;
+    maze_t *m = d->maze;
+    int x0, y0, w, h;
+    dist_tile_bounds (d, tile, &x0, &y0, &w, &h);
+    const byte *local = d->local + tile * d->local_bytes;
+    int offset = d->tiles[tile].offset % 3;
     
-    size_t lines_size = sizeof(*out->lines) * ((maze->width + 1) * (maze->height + 1) + 8);
-    out->lines = malloc (lines_size);
-    memset (out->lines, 0, lines_size);
+    for (int row = 0; row < h; row++)
+    {
+        int to = (y0 + row) * m->width + x0;
+        int cur_byte = to >> 2;
+        byte bits = 0;
+        for (int i = 0; i < w; i++, to++)
+        {
+            if ((to >> 2) != cur_byte)
+            {
+                __atomic_fetch_or (&m->mark_dist[cur_byte], bits, __ATOMIC_RELAXED);
+                cur_byte = to >> 2;
+                bits = 0;
+            }
+            bits |= ((get_dist3 (local, row * w + i) + offset) % 3) << (2*(to&3));
+        }
+        __atomic_fetch_or (&m->mark_dist[cur_byte], bits, __ATOMIC_RELAXED);
+    }
+}
 
-    out->numlines = 0;
+static void tiled_distances (maze_t *m)
+{
+    dist_tiling_t d;
+    d.maze = m;
+    d.tile_size = m->tile_size;
+    d.tiles_x = (m->width + d.tile_size - 1) / d.tile_size;
+    d.tiles_y = (m->height + d.tile_size - 1) / d.tile_size;
+    int num_tiles = d.tiles_x * d.tiles_y;
+    d.tiles = malloc (sizeof(*d.tiles) * num_tiles);
+    d.local_bytes = ((size_t)d.tile_size * d.tile_size >> 2) + 1;
+    d.local = malloc (d.local_bytes * num_tiles);
     
-    #define outline (out->lines[out->numlines])
+    // Find the passage through each tile's right and bottom edges, if any
+    int *right = malloc (sizeof(*right) * num_tiles), *down = malloc (sizeof(*down) * num_tiles);
+    for (int tile = 0; tile < num_tiles; tile++)
+    {
+        int x0, y0, w, h;
+        dist_tile_bounds (&d, tile, &x0, &y0, &w, &h);
+        right[tile] = down[tile] = -1;
+        for (int y = y0; y < y0 + h && x0 + w < m->width; y++)
+        {
+            if (get_bitmask (m->mark_passages, 2 * (y * m->width + x0 + w - 1)))
+                right[tile] = y * m->width + x0 + w - 1;
+        }
+        for (int x = x0; x < x0 + w && y0 + h < m->height; x++)
+        {
+            if (get_bitmask (m->mark_passages, 2 * ((y0 + h - 1) * m->width + x) + 1))
+                down[tile] = (y0 + h - 1) * m->width + x;
+        }
+        d.tiles[tile].parent = -2;
+    }
     
-    #define ADD_VERTLINE(x,y1,y2) \
-    { \
-        outline[0][0] = outline[1][0] = x; \
-        outline[0][1] = y1; \
-        outline[1][1] = y2; \
-        out->numlines++; \
+    // The tile tree, breadth first from the goal's tile
+    int *order = malloc (sizeof(*order) * num_tiles);
+    int head = 0, tail = 0;
+    order[tail++] = num_tiles - 1;
+    d.tiles[num_tiles - 1].parent = -1;
+    d.tiles[num_tiles - 1].exit = m->area - 1;
+    d.tiles[num_tiles - 1].offset = 0;
+    while (head != tail)
+    {
+        int tile = order[head++];
+        int col = tile % d.tiles_x;
+        int next[4] = {-1, -1, -1, -1}, exit[4], entry[4];
+        if (right[tile] >= 0)
+        {
+            next[0] = tile + 1;
+            exit[0] = right[tile] + 1;
+            entry[0] = right[tile];
+        }
+        if (col > 0 && right[tile - 1] >= 0)
+        {
+            next[1] = tile - 1;
+            exit[1] = right[tile - 1];
+            entry[1] = right[tile - 1] + 1;
+        }
+        if (down[tile] >= 0)
+        {
+            next[2] = tile + d.tiles_x;
+            exit[2] = down[tile] + m->width;
+            entry[2] = down[tile];
+        }
+        if (tile >= d.tiles_x && down[tile - d.tiles_x] >= 0)
+        {
+            next[3] = tile - d.tiles_x;
+            exit[3] = down[tile - d.tiles_x];
+            entry[3] = down[tile - d.tiles_x] + m->width;
+        }
+        for (int i = 0; i < 4; i++)
+        {
+            if (next[i] < 0 || d.tiles[next[i]].parent != -2)
+                continue;
+            d.tiles[next[i]].parent = tile;
+            d.tiles[next[i]].exit = exit[i];
+            d.tiles[next[i]].entry = entry[i];
+            order[tail++] = next[i];
+        }
     }
+    free (right);
+    free (down);
     
-    #define ADD_HORIZLINE(y,x1,x2) \
-    { \
-        outline[0][1] = outline[1][1] = y; \
-        outline[0][0] = x1; \
-        outline[1][0] = x2; \
-        out->numlines++; \
+    run_parallel (num_tiles, num_maze_threads (), search_dist_tile, &d);
+    for (int i = 1; i < num_tiles; i++)
+    {
+        dist_tile_t *tile = &d.tiles[order[i]];
+        tile->offset = d.tiles[tile->parent].offset + tile->entry_dist + 1;
     }
+    m->mark_dist = calloc ((m->area>>2) + 1, 1);
+    run_parallel (num_tiles, num_maze_threads (), merge_dist_tile, &d);
+    m->start_dist = d.tiles[0].offset + d.start_local;
+    
+    free (order);
+    free (d.tiles);
+    free (d.local);
+}
+
+static void compute_distances (maze_t *m)
+{
+    if (m->tile_size)
+        tiled_distances (m);
+    else
+        bfs_distances (m);
+}
+
+static void free_trace_cache (trace_cache_t *cache)
+{
+    free (cache->dirs);
+    free (cache->steps);
+    free (cache->lines);
+    memset (cache, 0, sizeof(*cache));
+}
+
+static maze_engine_t engine = maze_auto;
+
+// Above this many cells, maze_auto goes tiled
+static const int tiled_maze_area = 1 << 20;
+
+void set_maze_engine (maze_engine_t new_engine)
+{
+    engine = new_engine;
+}
+
+// Runs Prim's algorithm over all of m, whose mark_passages has to be clear
+static void prim_fill (maze_t *m, maze_rng_t *rng)
+{
+    m->mark_cells = make_bitmask (m->area);
+    m->num_wall_list = 0;
+    m->wall_list = malloc (sizeof(*m->wall_list) * 2 * m->area);
+    
+    visit_cell (m, rng_below (rng, m->area));
     
-    ADD_HORIZLINE (0, 4, 4*maze->width); // upper border
-    ADD_VERTLINE (0, 0, 4*maze->height); // left border
-    ADD_HORIZLINE (4*maze->height, 0, 4*maze->width - 4); //lower border
+    while (m->num_wall_list)
+        handle_wall (m, rng_below (rng, m->num_wall_list));
     
-    for (row = 0, cell = 0; row < maze->height; row++)
+    // Only needed while generating
+    free (m->mark_cells);
+    free (m->wall_list);
+    m->mark_cells = NULL;
+    m->wall_list = NULL;
+}
+
+static void prim_maze (maze_t *m, uint64_t seed)
+{
+    maze_rng_t rng;
+    rng_seed (&rng, seed);
+    prim_fill (m, &rng);
+}
+
+// Tiled Prim's, for mazes too big for one core. Each tile_size x tile_size
+// tile gets a maze of its own, generated in parallel from a seed of its own
+// (so the result only depends on the seed and the tile size, never on the
+// number of threads or the order they run in.) Then the tiles are joined 
+// along a random spanning tree of the tile grid, by one passage in a random
+// place on each border the tree crosses. A tree of trees joined by single 
+// edges is still a tree, so the whole thing is still a perfect maze. As a
+// bonus each tile's working memory fits in cache, which makes this faster
+// than plain Prim's even on one core.
+typedef struct
+{
+    maze_t *maze;
+    int tiles_x;
+    uint64_t seed;
+} tiling_t;
+
+static void generate_tile (void *ctx, int tile)
+{
+    const tiling_t *tiling = ctx;
+    maze_t *maze = tiling->maze;
+    int x0 = (tile % tiling->tiles_x) * tile_size, y0 = (tile / tiling->tiles_x) * tile_size;
+    
+    maze_t part;
+    initialize_maze (&part, min (tile_size, maze->width - x0), min (tile_size, maze->height - y0));
+    maze_rng_t rng;
+    rng_seed (&rng, tiling->seed ^ ((uint64_t)(tile + 1) << 32));
+    prim_fill (&part, &rng);
+    
+    // Tiles side by side can share a byte of mark_passages where they meet,
+    // so bits go in a byte at a time with an atomic OR
+    for (int row = 0; row < part.height; row++)
     {
-        for (col = 0; col < maze->width; col++, cell++)
+        int from = 2 * row * part.width, to = 2 * ((y0 + row) * maze->width + x0);
+        int cur_byte = to >> 3;
+        byte bits = 0;
+        for (int i = 0; i < 2 * part.width; i++, to++)
         {
-            if (!get_bitmask (maze->mark_passages, 2*cell+1) && row < maze->height - 1)
-                ADD_HORIZLINE (4*row + 4, 4*col, 4*col + 4);
-            if (!get_bitmask (maze->mark_passages, 2*cell))
-                ADD_VERTLINE (4*col + 4, 4*row, 4*row + 4);
+            if ((to >> 3) != cur_byte)
+            {
+                if (bits)
+                    __atomic_fetch_or (&maze->mark_passages[cur_byte], bits, __ATOMIC_RELAXED);
+                cur_byte = to >> 3;
+                bits = 0;
+            }
+            bits |= get_bitmask (part.mark_passages, from + i) << (to & 7);
         }
+        if (bits)
+            __atomic_fetch_or (&maze->mark_passages[cur_byte], bits, __ATOMIC_RELAXED);
     }
     
-    // Draw a small square indicating the goal point
-    ADD_HORIZLINE (4*maze->height - 3, 4*maze->width - 3, 4*maze->width - 1);
-    ADD_HORIZLINE (4*maze->height - 1, 4*maze->width - 3, 4*maze->width - 1);
-    ADD_VERTLINE (4*maze->width - 3, 4*maze->height - 3, 4*maze->height - 1);
-    ADD_VERTLINE (4*maze->width - 1, 4*maze->height - 3, 4*maze->height - 1);
+    free (part.mark_passages);
 }
 
-static maze_t maze;
-
-void generate_maze (int width, int height, mazepublic_t *out)
+static void tiled_maze (maze_t *maze, uint64_t seed)
 {
-    srand (time (NULL));
+    tiling_t tiling;
+    tiling.maze = maze;
+    tiling.tiles_x = (maze->width + tile_size - 1) / tile_size;
+    tiling.seed = seed;
+    maze->tile_size = tile_size;
+    int tiles_y = (maze->height + tile_size - 1) / tile_size;
     
-    initialize_maze (&maze, width, height);
+    run_parallel (tiling.tiles_x * tiles_y, num_maze_threads (), generate_tile, &tiling);
     
-    visit_cell (&maze, rand () % maze.area, -1);
+    // The spanning tree is just a (small) maze of tiles
+    maze_t tiles;
+    initialize_maze (&tiles, tiling.tiles_x, tiles_y);
+    maze_rng_t rng;
+    rng_seed (&rng, seed);
+    prim_fill (&tiles, &rng);
     
-    while (maze.num_wall_list)
+    for (int tile = 0; tile < tiles.area; tile++)
+    {
+        int x0 = (tile % tiles.width) * tile_size, y0 = (tile / tiles.width) * tile_size;
+        if (get_bitmask (tiles.mark_passages, 2*tile))
+        {
+            // Through the tile's right edge
+            int x = x0 + tile_size - 1;
+            int y = y0 + rng_below (&rng, min (tile_size, maze->height - y0));
+            set_bitmask (maze->mark_passages, 2 * (y * maze->width + x));
+        }
+        if (get_bitmask (tiles.mark_passages, 2*tile + 1))
+        {
+            // Through its bottom edge
+            int x = x0 + rng_below (&rng, min (tile_size, maze->width - x0));
+            int y = y0 + tile_size - 1;
+            set_bitmask (maze->mark_passages, 2 * (y * maze->width + x) + 1);
+        }
+    }
+    free (tiles.mark_passages);
+}
+
+static void copy_row_passages (void *ctx, int row, const byte *passages)
+{
+    maze_t *maze = ctx;
+    int first_wall = 2 * row * maze->width;
+    for (int wall = 0; wall < 2 * maze->width; wall++)
     {
-        int wall_list_num = rand () % maze.num_wall_list;
-        handle_wall (&maze, wall_list_num);
+        if (get_bitmask (passages, wall))
+            set_bitmask (maze->mark_passages, first_wall + wall);
     }
+}
+
+static void free_maze (maze_state_t *state)
+{
+    maze_t *maze = &state->maze;
+    free (maze->mark_cells);
+    free (maze->mark_passages);
+    free (maze->wall_list);
+    free (maze->mark_dist);
+    memset (maze, 0, sizeof(*maze));
+    state->trace_cache.num_steps = 0;
+}
+
+maze_state_t *new_maze_state (void)
+{
+    return calloc (1, sizeof(maze_state_t));
+}
+
+void free_maze_state (maze_state_t *state)
+{
+    free_maze (state);
+    free (state->lines_buffer);
+    free_trace_cache (&state->trace_cache);
+    free (state);
+}
+
+void generate_maze_in (maze_state_t *state, int width, int height, uint64_t seed, mazepublic_t *out)
+{
+    maze_t *maze = &state->maze;
+    free_maze (state);
+    initialize_maze (maze, width, height);
+    
+    maze_engine_t use = engine;
+    if (use == maze_auto)
+        use = maze->area > tiled_maze_area ? maze_tiled : maze_prim;
+    if (use == maze_eller)
+        eller_rows (width, height, seed, copy_row_passages, maze);
+    else if (use == maze_tiled)
+        tiled_maze (maze, seed);
+    else
+        prim_maze (maze, seed);
+
+    generate_maze_lines (state, out);
+}
+
+void generate_maze_seeded (int width, int height, uint64_t seed, mazepublic_t *out)
+{
+    generate_maze_in (&default_state, width, height, seed, out);
+}
 
-    generate_maze_lines (&maze, out);
+void generate_maze (int width, int height, mazepublic_t *out)
+{
+    // Never the same maze twice, even within the same second
+    static uint64_t count = 0;
+    uint64_t n = __atomic_fetch_add (&count, 1, __ATOMIC_RELAXED);
+    generate_maze_seeded (width, height, ((uint64_t)time (NULL) << 20) + n, out);
+}
+
+typedef struct
+{
+    int width, height;
+    mazepublic_t batch;
+    int *run_start;
+    maze_sink_t sink;
+    void *ctx;
+} stream_t;
+
+static void stream_row (void *ctx, int row, const byte *passages)
+{
+    stream_t *stream = ctx;
+    mazepublic_t *out = &stream->batch;
+    
+    if (row == 0)
+        add_border_lines (out, stream->width, stream->height);
+    add_row_lines (out, stream->run_start, passages, 0, row, stream->width, stream->height);
+    if (row == stream->height - 1)
+        add_goal_lines (out, stream->width, stream->height);
+    
+    stream->sink (stream->ctx, out);
+    out->numlines = 0;
+}
+
+void stream_maze (int width, int height, uint64_t seed, maze_sink_t sink, void *ctx)
+{
+    stream_t stream;
+    stream.width = width;
+    stream.height = height;
+    stream.sink = sink;
+    stream.ctx = ctx;
+    stream.batch.numlines = 0;
+    // One row of walls, plus the borders on the first and the goal on the 
+    // last
+    stream.batch.lines = malloc (sizeof(*stream.batch.lines) * (2 * width + 8));
+    stream.run_start = make_run_starts (width);
+    
+    eller_rows (width, height, seed, stream_row, &stream);
+    
+    free (stream.batch.lines);
+    free (stream.run_start);
 }
 
 void cleanup_maze (void)
 {
-    if (maze.mark_cells)
-        free (maze.mark_cells);
-    if (maze.mark_passages)
-        free (maze.mark_passages);
-    if (maze.in_wall_list)
-        free (maze.in_wall_list);
-    if (maze.wall_list)
-        free (maze.wall_list);
+    free_maze (&default_state);
+}
+
+void free_maze_buffers (void)
+{
+    free (default_state.lines_buffer);
+    default_state.lines_buffer = NULL;
+    default_state.lines_capacity = 0;
+    free_trace_cache (&default_state.trace_cache);
 }
 
 // arrows must be of size num_arrows
 // Returns true if the maze is solved by the directions given
-bool maze_trace (int num_arrows, arrow_t *arrows, mazepublic_t *out)
+bool maze_trace_in (maze_state_t *state, int num_arrows, arrow_t *arrows, mazepublic_t *out, maze_progress_t *progress)
 {
-    mazepoint_t lastpoint = {0, 0};
+    maze_t *maze = &state->maze;
+    trace_cache_t *cache = &state->trace_cache;
+    if (!maze->mark_dist)
+        compute_distances (maze);
     
-    size_t lines_size = sizeof(*out->lines) * (num_arrows + 5);
-    out->lines = malloc (lines_size);
-    memset (out->lines, 0, lines_size);
+    // The first trace needs somewhere to draw the start, arrows or not
+    if (num_arrows > cache->capacity || !cache->lines)
+    {
+        int capacity = max (64, max (num_arrows, 2 * cache->capacity));
+        cache->dirs = realloc (cache->dirs, sizeof(*cache->dirs) * capacity);
+        cache->steps = realloc (cache->steps, sizeof(*cache->steps) * capacity);
+        // One segment per arrow at most, plus the start square
+        cache->lines = realloc (cache->lines, sizeof(*cache->lines) * (capacity + 4));
+        cache->capacity = capacity;
+    }
     
-    out->numlines = 0;
+    // Pick up from the last arrow that's still the same as last time
+    int same = 0, limit = min (num_arrows, cache->num_steps);
+    while (same < limit && cache->dirs[same] == arrows[same].dir)
+        same++;
     
-    for (int i = 0; i < num_arrows; i++)
+    trace_step_t step;
+    if (same > 0)
+        step = cache->steps[same - 1];
+    else
     {
-        mazepoint_t nextpoint;
-        memcpy (nextpoint, lastpoint, sizeof(lastpoint));
-        switch (arrows[i].dir)
-        {
-            case arrow_up:
-                nextpoint[1]--;
-                break;
-            case arrow_down:
-                nextpoint[1]++;
-                break;
-            case arrow_left:
-                nextpoint[0]--;
-                break;
-            case arrow_right:
-                nextpoint[0]++;
-                break;
-        }
-        
-        if (nextpoint[0] < 0 || nextpoint[0] >= maze.width)
-            continue;
-        if (nextpoint[1] < 0 || nextpoint[1] >= maze.height)
-            continue;
-        
-        int last_cellnum = lastpoint[1] * maze.width + lastpoint[0];
-        int next_cellnum = nextpoint[1] * maze.width + nextpoint[0];
+        memset (&step, 0, sizeof(step));
+        step.dist = maze->start_dist;
+        step.first_wrong = -1;
+    }
+    
+    out->lines = cache->lines;
+    out->numlines = step.numlines;
+    
+    for (int i = same; i < num_arrows; i++)
+    {
+        cache->dirs[i] = arrows[i].dir;
         
-        if (get_bitmask (maze.mark_passages, wall_num_between_cells (&maze, last_cellnum, next_cellnum)))
+        int last_cellnum = step.point[1] * maze->width + step.point[0];
+        int next_cellnum = open_neighbour (maze, last_cellnum, arrows[i].dir);
+        if (next_cellnum >= 0)
         {
+            // Every step is either one closer or one further
+            if (get_dist3 (maze->mark_dist, next_cellnum) == (get_dist3 (maze->mark_dist, last_cellnum) + 2) % 3)
+                step.dist--;
+            else
+            {
+                step.dist++;
+                if (step.first_wrong < 0)
+                    step.first_wrong = i;
+            }
+            mazepoint_t nextpoint = {next_cellnum % maze->width, next_cellnum / maze->width};
             for (int j = 0; j < 2; j++)
             {
-                outline[0][j] = 4 * lastpoint[j] + 2;
+                outline[0][j] = 4 * step.point[j] + 2;
                 outline[1][j] = 4 * nextpoint[j] + 2;
             }
             out->numlines++;
-            memcpy (lastpoint, nextpoint, sizeof(lastpoint));
+            memcpy (step.point, nextpoint, sizeof(nextpoint));
         }
+        
+        step.numlines = out->numlines;
+        cache->steps[i] = step;
     }
+    cache->num_steps = num_arrows;
     
     // Draw a small square indicating the start point
     ADD_HORIZLINE (1, 1, 3);
@@ -298,5 +1292,19 @@ bool maze_trace (int num_arrows, arrow_t *arrows, mazepublic_t *out)
     ADD_VERTLINE (1, 1, 3);
     ADD_VERTLINE (3, 1, 3);
     
-    return lastpoint[0] == maze.width - 1 && lastpoint[1] == maze.height - 1;
+    if (progress)
+    {
+        progress->start_dist = maze->start_dist;
+        progress->dist = step.dist;
+        progress->first_wrong = step.first_wrong;
+        memcpy (progress->end, step.point, sizeof(step.point));
+        progress->hint = dir_towards_goal (maze, step.point[1] * maze->width + step.point[0]);
+    }
+    
+    return step.point[0] == maze->width - 1 && step.point[1] == maze->height - 1;
+}
+
+bool maze_trace (int num_arrows, arrow_t *arrows, mazepublic_t *out, maze_progress_t *progress)
+{
+    return maze_trace_in (&default_state, num_arrows, arrows, out, progress);
 }
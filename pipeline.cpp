@@ -0,0 +1,269 @@
+/*
+Mazedemo, by Max Eliaser
+
+Copyright (c) 2014 Intel Corp.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Runs the image-processing stages on worker threads. In staged mode every
+// stage gets its own thread and the stages are joined by bounded queues, so 
+// several frames are in flight at once and throughput is limited by the 
+// slowest stage rather than the sum of all of them.
+//
+// Frames are dropped at the cheap end of the pipeline only: the input 
+// mailbox keeps just the newest frame, and the queue out of the gray stage 
+// evicts its oldest entry when the edge detector falls behind. Past that
+// point the queues apply backpressure instead, so a frame that has had 
+// real work done on it is never thrown away. That also means every frame 
+// the edge stage sees reaches the contour stage, in order, which is what 
+// keeps incremental re-detection's state consistent between the two.
+
+#include "opencv2/imgproc/imgproc.hpp"
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include "mazedemo_common.h"
+#include "trace.h"
+
+using namespace cv;
+using namespace std;
+
+void detect_pipeline_t::start (pipeline_mode_t mode)
+{
+    quit = false;
+    
+    free_frames.init (num_frames, queue_block);
+    for (int i = 0; i < num_frames; i++)
+        free_frames.push (&frames[i]);
+    queues[0].init (queue_depth, queue_drop_oldest);
+    for (int i = 1; i < num_stages - 1; i++)
+        queues[i].init (queue_depth, queue_block);
+    
+    if (mode == pipeline_serial)
+    {
+        threads.push_back (thread (&detect_pipeline_t::run_serial, this));
+        return;
+    }
+    
+    threads.push_back (thread (&detect_pipeline_t::run_gray, this));
+    for (int i = 1; i < num_stages - 1; i++)
+        threads.push_back (thread (&detect_pipeline_t::run_stage, this, i));
+    threads.push_back (thread (&detect_pipeline_t::run_render, this));
+}
+
+void detect_pipeline_t::stop (void)
+{
+    quit = true;
+    wake.notify_one ();
+    free_frames.close ();
+    for (int i = 0; i < num_stages - 1; i++)
+        queues[i].close ();
+    for (auto i = threads.begin (); i != threads.end (); i++)
+        i->join ();
+    threads.clear ();
+    
+    // Capture buffers go back to the source, which may be deleted next
+    input.clear ();
+    for (int i = 0; i < num_frames; i++)
+        release_capture (&frames[i]);
+}
+
+void detect_pipeline_t::submit (void)
+{
+    input.publish ();
+    wake.notify_one ();
+}
+
+detect_result_t *detect_pipeline_t::poll (void)
+{
+    if (!output.fetch ())
+        return NULL;
+    return &output.read_slot ();
+}
+
+// Waits for the UI thread to submit a new frame. Returns false when it's
+// time to shut down.
+bool detect_pipeline_t::next_input (void)
+{
+    while (!quit)
+    {
+        if (input.fetch ())
+            return true;
+        
+        // The UI thread doesn't take the lock before notifying, so a wakeup
+        // can slip in between the check and the wait. The timeout bounds 
+        // how long that can cost us.
+        unique_lock<mutex> lock (wake_lock);
+        wake.wait_for (lock, chrono::milliseconds (5));
+    }
+    return false;
+}
+
+// Gray stage: pick up the newest submitted frame
+void detect_pipeline_t::begin_frame (frame_t *frame)
+{
+    detect_input_t &in = input.read_slot ();
+    frame->frame_num = in.frame_num;
+    frame->capture_time = in.capture_time;
+    frame->scale = in.scale;
+    TRACE_FRAME (frame->frame_num);
+    if (!in.gray.empty ())
+    {
+        // Already luma, possibly straight out of the capture buffer
+        frame->gray = in.gray;
+        frame->lease.swap (in.lease);
+        in.gray = Mat ();
+        in.lease.reset ();
+        return;
+    }
+    TRACE_SCOPE ("cvtColor");
+    cvtColor (in.bgr, frame->gray, CV_BGR2GRAY);
+}
+
+// Once a frame is done with, a gray that was borrowed from the source goes 
+// back, and frame->gray mustn't be written into where it points any more
+void detect_pipeline_t::release_capture (frame_t *frame)
+{
+    if (frame->lease)
+    {
+        frame->lease.reset ();
+        frame->gray = Mat ();
+    }
+}
+
+void detect_pipeline_t::find_edges (frame_t *frame)
+{
+    if (detect_config.incremental)
+        detect_changed_edges (frame->gray, state, frame->changes, frame->edges);
+    else if (detect_config.pyramid_levels > 0)
+        detect_coarse_edges (frame->gray, detect_config.pyramid_levels, frame->small, frame->edges);
+    else if (frame->scale < 1)
+        detect_scaled_edges (frame->gray, frame->scale, frame->small, frame->edges);
+    else
+        detect_edges (frame->gray, frame->edges);
+}
+
+void detect_pipeline_t::find_contours (frame_t *frame)
+{
+    if (detect_config.incremental)
+        detect_changed_contours (frame->edges, frame->gray, frame->changes, state, frame->candidates);
+    else if (detect_config.pyramid_levels > 0)
+        detect_refined_contours (frame->edges, frame->small, frame->gray, detect_config.pyramid_levels, frame->candidates);
+    else if (frame->scale < 1)
+        detect_scaled_contours (frame->edges, frame->small, frame->scale, frame->candidates);
+    else
+        detect_contours (frame->edges, frame->gray, frame->candidates, detect_config.track ? &state.still : NULL);
+}
+
+void detect_pipeline_t::classify (frame_t *frame)
+{
+    if (detect_config.track)
+        state.tracker.update (frame->candidates, frame->arrows);
+    else
+        classify_candidates (frame->candidates, frame->arrows);
+}
+
+// Render stage: hand the results to the UI thread. Nothing gets drawn on
+// the pipeline's threads; the UI draws the visualization from the result 
+// if it wants one. The swaps trade buffers with the result slot, so after 
+// the first few frames neither side allocates.
+void detect_pipeline_t::finish_frame (frame_t *frame)
+{
+    TRACE_FRAME (frame->frame_num);
+    detect_result_t &out = output.write_slot ();
+    out.frame_num = frame->frame_num;
+    out.capture_time = frame->capture_time;
+    out.candidates.swap (frame->candidates);
+    out.arrows.swap (frame->arrows);
+    output.publish ();
+    release_capture (frame);
+}
+
+void detect_pipeline_t::run_serial (void)
+{
+    TRACE_THREAD_NAME ("detect");
+    frame_t *frame = &frames[0];
+    while (next_input ())
+    {
+        begin_frame (frame);
+        find_edges (frame);
+        find_contours (frame);
+        classify (frame);
+        finish_frame (frame);
+    }
+}
+
+void detect_pipeline_t::run_gray (void)
+{
+    TRACE_THREAD_NAME ("gray");
+    frame_t *frame, *dropped;
+    while (next_input ())
+    {
+        if (!free_frames.pop (frame))
+            break;
+        begin_frame (frame);
+        if (!queues[0].push (frame, &dropped))
+            break;
+        if (dropped)
+        {
+            release_capture (dropped);
+            free_frames.push (dropped);
+        }
+    }
+}
+
+// The stages in the middle all look the same: take a frame from the 
+// previous stage, work on it, pass it along.
+void detect_pipeline_t::run_stage (int stage)
+{
+    static const char *names[] = {"gray", "edges", "contours", "classify", "render"};
+    TRACE_THREAD_NAME (names[stage]);
+    
+    frame_t *frame;
+    while (queues[stage - 1].pop (frame))
+    {
+        TRACE_FRAME (frame->frame_num);
+        switch (stage)
+        {
+            case 1:
+                find_edges (frame);
+                break;
+            case 2:
+                find_contours (frame);
+                break;
+            case 3:
+                classify (frame);
+                break;
+        }
+        if (!queues[stage].push (frame))
+            break;
+    }
+}
+
+void detect_pipeline_t::run_render (void)
+{
+    TRACE_THREAD_NAME ("render");
+    frame_t *frame;
+    while (queues[num_stages - 2].pop (frame))
+    {
+        finish_frame (frame);
+        free_frames.push (frame);
+    }
+}
@@ -0,0 +1,189 @@
+/*
+Mazedemo, by Max Eliaser
+
+Copyright (c) 2014 Intel Corp.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Several stations in one process. Each session is a camera (or any other
+// frame source) with its own maze, trace and detection state, so sessions
+// never share anything but the read-only settings. The scheduler hands them
+// out round robin to a pool of threads: a thread takes the session that has
+// waited longest, runs one frame of it, and puts it back at the end of the
+// line. So a session is never on two threads at once, and a slow one only
+// holds up its own frames.
+
+#include "opencv2/imgproc/imgproc.hpp"
+#include <iostream>
+#include <string.h>
+#include <time.h>
+#include "mazedemo_common.h"
+#include "trace.h"
+
+using namespace cv;
+using namespace std;
+
+session_t::session_t (int _id, frame_source_t *_source, int _maze_side, uint64_t seed) :
+    id (_id), source (_source), maze_side (_maze_side), next_seed (seed), 
+    frames (0), solved (0)
+{
+    maze_state = new_maze_state ();
+    new_maze ();
+}
+
+session_t::~session_t (void)
+{
+    // The lease has to go back before its source does
+    lease.reset ();
+    delete source;
+    free_maze_state (maze_state);
+}
+
+void session_t::new_maze (void)
+{
+    generate_maze_in (maze_state, maze_side, maze_side, next_seed++, &maze);
+    memset (&trace, 0, sizeof(trace));
+    memset (&progress, 0, sizeof(progress));
+    progress.first_wrong = progress.hint = -1;
+}
+
+bool session_t::step (void)
+{
+    {
+        TRACE_SCOPE ("capture");
+        if (source->has_luma ())
+        {
+            if (!source->getluma (gray, lease))
+                return false;
+        }
+        else
+        {
+            if (!source->getframe (frame))
+                return false;
+            cvtColor (frame, gray, CV_BGR2GRAY);
+        }
+    }
+    frames++;
+    
+    do_process (gray, arrows, &detect);
+    
+    TRACE_SCOPE ("maze_trace");
+    if (maze_trace_in (maze_state, arrows.size (), arrows.empty () ? NULL : &arrows[0], &trace, &progress))
+    {
+        solved++;
+        new_maze ();
+    }
+    return true;
+}
+
+session_scheduler_t::~session_scheduler_t (void)
+{
+    for (size_t i = 0; i < sessions.size (); i++)
+        delete sessions[i];
+}
+
+void session_scheduler_t::add (frame_source_t *source, int maze_side, uint64_t seed)
+{
+    sessions.push_back (new session_t (sessions.size (), source, maze_side, seed));
+}
+
+void session_scheduler_t::run (int num_threads, int max_frames)
+{
+    if (sessions.empty ())
+        return;
+    if (num_threads <= 0)
+        num_threads = max (1u, thread::hardware_concurrency ());
+    
+    // Never more in it than there are sessions, so putting one back can't
+    // block. Whoever finishes the last session closes it, which sends 
+    // everyone else home.
+    bounded_queue_t<session_t *> ready;
+    ready.init (sessions.size (), queue_block);
+    for (size_t i = 0; i < sessions.size (); i++)
+        ready.push (sessions[i]);
+    atomic<int> running (sessions.size ());
+    
+    auto work = [&] (void)
+    {
+        TRACE_THREAD_NAME ("session");
+        session_t *session;
+        while (ready.pop (session))
+        {
+            TRACE_FRAME (session->frames + 1);
+            bool more = session->step () && (max_frames == 0 || session->frames < max_frames);
+            if (more)
+                ready.push (session);
+            else if (--running == 0)
+                ready.close ();
+        }
+    };
+    
+    vector<thread> threads;
+    for (int t = 1; t < num_threads; t++)
+        threads.push_back (thread (work));
+    work ();
+    for (size_t t = 0; t < threads.size (); t++)
+        threads[t].join ();
+}
+
+// Every session's Nth maze is made from its own seed plus N, with the 
+// session number in the top bits so no two sessions ever get the same one
+static uint64_t session_seed (uint64_t seed, int session)
+{
+    return seed + ((uint64_t)session << 40);
+}
+
+int run_sessions (const vector<string> &specs, bool seeded, uint64_t seed, int maze_side, int num_threads, int max_frames)
+{
+    if (!seeded)
+        seed = (uint64_t)time (NULL) << 20;
+    
+    session_scheduler_t scheduler;
+    for (size_t i = 0; i < specs.size (); i++)
+    {
+        frame_source_t *source = open_frame_source (specs[i].c_str ());
+        if (!source)
+            return 1;
+        
+        // The size thresholds are shared, so they go by the first station's
+        // frames, and any other station had better match
+        Size size = source->frame_size ();
+        if (i == 0)
+            fit_capture_size (source);
+        else if (size.area () && (size.width != cfg_w || size.height != cfg_h))
+            cout << "Warning: " << specs[i] << " has " << size.width << "x" << size.height << " frames, but detection is set up for "
+                 << cfg_w << "x" << cfg_h << endl;
+        scheduler.add (source, maze_side, session_seed (seed, i));
+    }
+    
+    timestamp_t start = chrono::steady_clock::now ();
+    scheduler.run (num_threads, max_frames);
+    double secs = chrono::duration<double> (chrono::steady_clock::now () - start).count ();
+    
+    int frames = 0;
+    for (size_t i = 0; i < specs.size (); i++)
+    {
+        const session_t *session = scheduler.get (i);
+        printf ("session %d (%s): %d frames, %d mazes solved\n", session->id, specs[i].c_str (), session->frames, session->solved);
+        frames += session->frames;
+    }
+    printf ("%d sessions, %d frames in %.3f s: %.2f fps in all\n", (int)specs.size (), frames, secs, secs > 0 ? frames / secs : 0.0);
+    return 0;
+}
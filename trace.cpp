@@ -0,0 +1,152 @@
+/*
+Mazedemo, by Max Eliaser
+
+Copyright (c) 2014 Intel Corp.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include "trace.h"
+
+using namespace std;
+
+#ifndef MAZE_NO_TRACE
+
+// Must be a power of two. At a few dozen events per frame this holds the
+// last several seconds of activity.
+static const uint64_t ring_size = 1 << 16;
+static const int max_threads = 64;
+
+// Each slot is a tiny seqlock: seq is zeroed while the slot is being 
+// rewritten and set to the event's index+1 once it's complete, so the 
+// dumper can skip slots that are torn or have been recycled under it.
+typedef struct
+{
+    atomic<uint64_t> seq;
+    atomic<const char *> name;
+    atomic<uint64_t> start, end;
+    atomic<int> tid, frame_num;
+} trace_event_t;
+
+static trace_event_t ring[ring_size];
+static atomic<uint64_t> ring_head (0);
+static atomic<int> num_threads (0);
+static atomic<const char *> thread_names[max_threads];
+
+static thread_local int thread_id = -1;
+static thread_local int current_frame = -1;
+
+static int get_thread_id (void)
+{
+    if (thread_id < 0)
+        thread_id = num_threads++;
+    return thread_id;
+}
+
+uint64_t trace_now (void)
+{
+    return chrono::duration_cast<chrono::nanoseconds> (chrono::steady_clock::now ().time_since_epoch ()).count ();
+}
+
+void trace_record (const char *name, uint64_t start, uint64_t end)
+{
+    uint64_t idx = ring_head.fetch_add (1, memory_order_relaxed);
+    trace_event_t &ev = ring[idx & (ring_size - 1)];
+    
+    ev.seq.store (0, memory_order_relaxed);
+    atomic_thread_fence (memory_order_release);
+    ev.name.store (name, memory_order_relaxed);
+    ev.start.store (start, memory_order_relaxed);
+    ev.end.store (end, memory_order_relaxed);
+    ev.tid.store (get_thread_id (), memory_order_relaxed);
+    ev.frame_num.store (current_frame, memory_order_relaxed);
+    ev.seq.store (idx + 1, memory_order_release);
+}
+
+void trace_set_frame (int frame_num)
+{
+    current_frame = frame_num;
+}
+
+void trace_set_thread_name (const char *name)
+{
+    int tid = get_thread_id ();
+    if (tid < max_threads)
+        thread_names[tid] = name;
+}
+
+bool trace_dump (const char *path)
+{
+    FILE *out = fopen (path, "w");
+    if (!out)
+    {
+        perror (path);
+        return false;
+    }
+    
+    fprintf (out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    bool first = true;
+    
+    int threads = num_threads;
+    for (int tid = 0; tid < threads && tid < max_threads; tid++)
+    {
+        const char *name = thread_names[tid];
+        fprintf (out, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                 first ? "" : ",\n", tid, name ? name : "unnamed");
+        first = false;
+    }
+    
+    uint64_t head = ring_head.load (memory_order_acquire);
+    uint64_t tail = head > ring_size ? head - ring_size : 0;
+    for (uint64_t idx = tail; idx < head; idx++)
+    {
+        trace_event_t &ev = ring[idx & (ring_size - 1)];
+        uint64_t seq = ev.seq.load (memory_order_acquire);
+        const char *name = ev.name.load (memory_order_relaxed);
+        uint64_t start = ev.start.load (memory_order_relaxed);
+        uint64_t end = ev.end.load (memory_order_relaxed);
+        int tid = ev.tid.load (memory_order_relaxed);
+        int frame_num = ev.frame_num.load (memory_order_relaxed);
+        atomic_thread_fence (memory_order_acquire);
+        if (seq != idx + 1 || ev.seq.load (memory_order_relaxed) != seq)
+            continue;
+        
+        fprintf (out, "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"frame\": %d}}",
+                 first ? "" : ",\n", name, tid, start / 1000.0, (end - start) / 1000.0, frame_num);
+        first = false;
+    }
+    
+    fprintf (out, "\n]}\n");
+    fclose (out);
+    printf ("Wrote trace to %s\n", path);
+    return true;
+}
+
+#else
+
+bool trace_dump (const char *path)
+{
+    printf ("Tracing was compiled out (built with MAZE_NO_TRACE), not writing %s\n", path);
+    return false;
+}
+
+#endif
@@ -0,0 +1,76 @@
+/*
+Mazedemo, by Max Eliaser
+
+Copyright (c) 2014 Intel Corp.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Lightweight per-stage tracing. Wrap a block in TRACE_SCOPE ("name") and 
+// its duration is logged, along with the thread and the frame being worked 
+// on, to an in-memory ring buffer that can be dumped at any time as 
+// Chrome/Perfetto trace-event JSON (load it in chrome://tracing or 
+// ui.perfetto.dev.) Logging an event is a couple of clock reads and an
+// atomic increment; nothing is allocated and nothing is locked.
+//
+// Build with -DMAZE_NO_TRACE (make TRACE=0) and the macros compile away to
+// nothing.
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#ifndef MAZE_NO_TRACE
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2 (a, b)
+
+// name must be a string literal (or otherwise live forever)
+#define TRACE_SCOPE(name) trace_scope_t TRACE_CONCAT (trace_scope_, __LINE__) (name)
+#define TRACE_FRAME(frame_num) trace_set_frame (frame_num)
+#define TRACE_THREAD_NAME(name) trace_set_thread_name (name)
+
+uint64_t trace_now (void); // nanoseconds
+void trace_record (const char *name, uint64_t start, uint64_t end);
+void trace_set_frame (int frame_num);
+void trace_set_thread_name (const char *name);
+
+class trace_scope_t
+{
+    const char *name;
+    uint64_t start;
+public:
+    trace_scope_t (const char *_name) : name (_name), start (trace_now ()) {}
+    ~trace_scope_t (void) {trace_record (name, start, trace_now ());}
+};
+
+#else
+
+#define TRACE_SCOPE(name) do {} while (0)
+#define TRACE_FRAME(frame_num) do {} while (0)
+#define TRACE_THREAD_NAME(name) do {} while (0)
+
+#endif
+
+// Writes everything still in the ring buffer to path. Returns false (after
+// saying why) if the file can't be written or tracing is compiled out.
+bool trace_dump (const char *path);
+
+#endif
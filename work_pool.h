@@ -0,0 +1,178 @@
+/*
+Mazedemo, by Max Eliaser
+
+Copyright (c) 2014 Intel Corp.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Runs a fixed set of numbered tasks on a pool of threads, with work 
+// stealing: each worker starts out owning an even, contiguous share of the 
+// tasks and works through it from the front, and one that runs out takes 
+// tasks from the back of whichever share has the most left. So each thread
+// mostly works on its own neighbouring tasks, and none sits idle while 
+// there's anything left to do, however uneven the tasks are.
+//
+// The threads are started the first time they're needed and then kept, 
+// waiting between runs, until the pool goes away. So a pool that lives as
+// long as whatever keeps calling run (a stage thread, say) can be run 
+// every frame without creating threads every frame.
+
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <algorithm>
+
+class work_pool_t
+{
+    struct share_t
+    {
+        std::mutex lock;
+        int begin, end; // tasks not started yet
+    };
+    
+    std::unique_ptr<share_t[]> shares;
+    int num_shares;
+    int num_workers;
+    
+    // Worker threads 1 and up; worker 0 is whoever calls run
+    std::vector<std::thread> threads;
+    std::mutex lock;
+    std::condition_variable wake, finished;
+    // The current run's fn, called through a plain function pointer rather
+    // than a std::function, which can allocate
+    void (*call) (const void *fn, int task, int worker);
+    const void *job;
+    unsigned long generation; // bumped once per run
+    int busy; // threads still on the current run
+    bool quitting;
+    
+    // Next task for worker, its own or stolen, or -1 once there are none
+    int next_task (int worker)
+    {
+        {
+            std::lock_guard<std::mutex> guard (shares[worker].lock);
+            if (shares[worker].begin < shares[worker].end)
+                return shares[worker].begin++;
+        }
+        for (;;)
+        {
+            int victim = -1, most = 0;
+            for (int w = 0; w < num_workers; w++)
+            {
+                std::lock_guard<std::mutex> guard (shares[w].lock);
+                if (shares[w].end - shares[w].begin > most)
+                {
+                    victim = w;
+                    most = shares[w].end - shares[w].begin;
+                }
+            }
+            if (victim < 0)
+                return -1;
+            std::lock_guard<std::mutex> guard (shares[victim].lock);
+            if (shares[victim].begin < shares[victim].end)
+                return --shares[victim].end;
+            // Someone else got there first; look again
+        }
+    }
+    
+    void work (int worker)
+    {
+        int task;
+        while ((task = next_task (worker)) >= 0)
+            call (job, task, worker);
+    }
+    
+    void helper (int worker)
+    {
+        unsigned long seen = 0;
+        std::unique_lock<std::mutex> guard (lock);
+        for (;;)
+        {
+            wake.wait (guard, [&] {return quitting || generation != seen;});
+            if (quitting)
+                return;
+            seen = generation;
+            // Left over from a run with more threads than this one
+            if (worker >= num_workers)
+                continue;
+            guard.unlock ();
+            work (worker);
+            guard.lock ();
+            if (--busy == 0)
+                finished.notify_one ();
+        }
+    }
+    
+public:
+    work_pool_t (void) : num_shares (0), num_workers (0), call (NULL), job (NULL), generation (0), busy (0), quitting (false) {}
+    
+    ~work_pool_t (void)
+    {
+        {
+            std::lock_guard<std::mutex> guard (lock);
+            quitting = true;
+        }
+        wake.notify_all ();
+        for (auto t = threads.begin (); t != threads.end (); t++)
+            t->join ();
+    }
+    
+    // Calls fn (task, worker) for every task from 0 to num_tasks-1 on 
+    // num_threads threads, the calling one included (as worker 0), and 
+    // returns once they're all done.
+    template<typename fn_t>
+    void run (int num_tasks, int num_threads, const fn_t &fn)
+    {
+        int workers = std::max (1, num_threads);
+        if (num_shares < workers)
+        {
+            shares.reset (new share_t[workers]);
+            num_shares = workers;
+        }
+        for (int w = 0; w < workers; w++)
+        {
+            shares[w].begin = (long long)num_tasks * w / workers;
+            shares[w].end = (long long)num_tasks * (w + 1) / workers;
+        }
+        while ((int)threads.size () < workers - 1)
+            threads.push_back (std::thread (&work_pool_t::helper, this, (int)threads.size () + 1));
+        
+        {
+            std::lock_guard<std::mutex> guard (lock);
+            num_workers = workers;
+            call = [] (const void *f, int task, int worker) {(*(const fn_t *)f) (task, worker);};
+            job = &fn;
+            busy = workers - 1;
+            generation++;
+        }
+        wake.notify_all ();
+        work (0);
+        
+        std::unique_lock<std::mutex> guard (lock);
+        finished.wait (guard, [&] {return busy == 0;});
+    }
+};
+
+#endif